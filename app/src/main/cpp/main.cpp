@@ -5,8 +5,21 @@
 #include <android_native_app_glue.h>
 #endif
 #include "match3_engine.h"
+#include "match3_simd.h"
+#include "match3_board.h"
+#include "match3_batch.h"
+#include "match3_log.h"
+#include "match3_sessions.h"
+#include "match3_search.h"
+#include "match3_zobrist.h"
 #include <iostream>
 #include <cassert>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <thread>
 #define LOG_TAG "MyAppTag"
 #ifdef __ANDROID__
 #include <android/log.h>
@@ -16,6 +29,121 @@
 #define LOGD(...) printf(__VA_ARGS__); printf("\n")
 #endif
 
+// Pass-through global allocator that counts allocations while enabled, for
+// testAllocationFreeCascade(). main.cpp is linked into the app library, so
+// it is only compiled in with MATCH3_COUNT_ALLOCATIONS; it would otherwise
+// replace the allocator for every native library in the process.
+#ifdef MATCH3_COUNT_ALLOCATIONS
+static atomic<bool> countingAllocations{false};
+static atomic<long> allocationCount{0};
+
+// Every replaceable form below allocates here and frees with free(), so
+// any new pairs with any delete.
+static void* countedAllocate(size_t size, size_t alignment = alignof(max_align_t)) noexcept {
+    if (countingAllocations.load(memory_order_relaxed)) {
+        allocationCount.fetch_add(1, memory_order_relaxed);
+    }
+    if (alignment <= alignof(max_align_t)) {
+        return malloc(size ? size : 1);
+    }
+    void* memory = nullptr;
+    return posix_memalign(&memory, alignment, size ? size : 1) == 0 ? memory : nullptr;
+}
+
+static void* countedAllocateOrAbort(size_t size, size_t alignment = alignof(max_align_t)) {
+    void* memory = countedAllocate(size, alignment);
+    if (memory == nullptr) {
+        abort();
+    }
+    return memory;
+}
+
+void* operator new(size_t size) {
+    return countedAllocateOrAbort(size);
+}
+
+void* operator new[](size_t size) {
+    return countedAllocateOrAbort(size);
+}
+
+void* operator new(size_t size, align_val_t alignment) {
+    return countedAllocateOrAbort(size, size_t(alignment));
+}
+
+void* operator new[](size_t size, align_val_t alignment) {
+    return countedAllocateOrAbort(size, size_t(alignment));
+}
+
+// The nothrow forms (e.g. stable_sort's buffer).
+void* operator new(size_t size, const nothrow_t&) noexcept {
+    return countedAllocate(size);
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept {
+    return countedAllocate(size);
+}
+
+void* operator new(size_t size, align_val_t alignment, const nothrow_t&) noexcept {
+    return countedAllocate(size, size_t(alignment));
+}
+
+void* operator new[](size_t size, align_val_t alignment, const nothrow_t&) noexcept {
+    return countedAllocate(size, size_t(alignment));
+}
+
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept {
+    free(memory);
+}
+
+void operator delete(void* memory, align_val_t) noexcept {
+    free(memory);
+}
+
+void operator delete[](void* memory, align_val_t) noexcept {
+    free(memory);
+}
+
+void operator delete(void* memory, size_t, align_val_t) noexcept {
+    free(memory);
+}
+
+void operator delete[](void* memory, size_t, align_val_t) noexcept {
+    free(memory);
+}
+
+void operator delete(void* memory, const nothrow_t&) noexcept {
+    free(memory);
+}
+
+void operator delete[](void* memory, const nothrow_t&) noexcept {
+    free(memory);
+}
+
+void operator delete(void* memory, align_val_t, const nothrow_t&) noexcept {
+    free(memory);
+}
+
+void operator delete[](void* memory, align_val_t, const nothrow_t&) noexcept {
+    free(memory);
+}
+#else
+// Nothing is counted: testAllocationFreeCascade() only runs the rounds.
+static bool countingAllocations = false;
+static long allocationCount = 0;
+#endif
+
 void testHorizontalMatch() {
     Match3Engine engine(5, 5, 3);
 
@@ -37,6 +165,67 @@ void testHorizontalMatch() {
     LOGD("✓ Horizontal match test passed\n");
 }
 
+void testMatchMask() {
+    Match3Engine engine(5, 5, 3);
+    engine.setGrid({
+                           {0, 0, 0, 1, 2},
+                           {1, 2, 1, 2, 2},
+                           {2, 1, 2, 1, 2},
+                           {1, 2, 1, 2, 1},
+                           {2, 1, 2, 1, 2}
+                   });
+
+    BoardMask mask = engine.findMatchMask();
+    assert(mask.count() == 6);
+    assert(mask.test(0, 0) && mask.test(0, 1) && mask.test(0, 2));
+    assert(mask.test(0, 4) && mask.test(1, 4) && mask.test(2, 4));
+    assert(!mask.test(0, 3));
+    assert(engine.findAllMatches().size() == 6);
+
+    LOGD("✓ Match mask test passed\n");
+}
+
+void testWideBoardMatches() {
+    // Wider than one bitboard word, so detection goes through the SIMD kernels.
+    const int width = 70;
+    const int height = 4;
+    vector<vector<Cell>> grid(height, vector<Cell>(width));
+    for (int row = 0; row < height; row++) {
+        for (int col = 0; col < width; col++) {
+            grid[row][col] = Cell((row + col) % 2 == 0 ? 0 : 1 + row % 2);
+        }
+    }
+    // Horizontal run across the 64-column word boundary.
+    for (int col = 62; col < 66; col++) {
+        grid[1][col] = Cell(3);
+    }
+    // Vertical run in the last column.
+    for (int row = 0; row < 3; row++) {
+        grid[row][width - 1] = Cell(4);
+    }
+
+    SimdLevel defaultLevel = simdKernels().level;
+    const SimdLevel levels[] = {SimdLevel::SCALAR, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::NEON};
+    for (SimdLevel level: levels) {
+        if (!selectSimdKernels(level)) {
+            continue;
+        }
+        Match3Engine engine(width, height, 5);
+        engine.setGrid(grid);
+        auto matches = engine.findAllMatches();
+        assert(matches.size() == 7);
+        for (int col = 62; col < 66; col++) {
+            assert(matches.count({1, col}) == 1);
+        }
+        for (int row = 0; row < 3; row++) {
+            assert(matches.count({row, width - 1}) == 1);
+        }
+    }
+    selectSimdKernels(defaultLevel);
+
+    LOGD("✓ Wide board match test passed\n");
+}
+
 void testGravity() {
     Match3Engine engine(3, 3, 2);
 
@@ -67,6 +256,35 @@ void testGravity() {
     assert(engine.getItem(2, 1) == 1);
     assert(engine.getItem(2, 2) == 0);
 
+    // Fall distances, recorded at each item's new cell.
+    assert(engine.getFallDistance(1, 0) == 1 && engine.getFallDistance(2, 0) == 0);
+    assert(engine.getFallDistance(1, 2) == 1 && engine.getFallDistance(1, 1) == 0);
+
+    // Columns taller than one 64-bit occupancy word.
+    Match3Random rng(17);
+    vector<vector<Cell>> grid(150, vector<Cell>(3));
+    for (auto& row: grid) {
+        for (Cell& cell: row) {
+            cell = Cell(rng.nextInt(4) == 0 ? -1 : rng.nextInt(3));
+        }
+    }
+    Match3Engine tall(3, 150, 3, 1);
+    tall.setGrid(grid);
+    tall.applyGravity();
+    for (int col = 0; col < 3; col++) {
+        int target = 149;
+        for (int row = 149; row >= 0; row--) {
+            if (grid[row][col].type >= 0) {
+                assert(tall.getItem(col, target) == grid[row][col].type);
+                assert(tall.getFallDistance(target, col) == target - row);
+                target--;
+            }
+        }
+        for (; target >= 0; target--) {
+            assert(tall.getItem(col, target) == -1);
+        }
+    }
+
     LOGD("\n✓ Gravity test PASSED\n");
 }
 
@@ -85,6 +303,17 @@ void testCascade() {
     LOGD("✓ Cascade test passed\n");
 }
 
+void testCascadeLeavesNoMatches() {
+    // Steps after the first only rescan dirty rows and columns; the board
+    // must still end up with no match anywhere.
+    for (int round = 0; round < 20; round++) {
+        Match3Engine engine(12, 12, 3);
+        engine.processCascade();
+        assert(engine.findAllMatches().empty());
+    }
+    LOGD("✓ Cascade leaves no matches test passed\n");
+}
+
 void testHasValidMoves() {
     Match3Engine engine(5, 3, 3);
     engine.setGrid({
@@ -139,6 +368,45 @@ void testFindHint() {
     LOGD("✓ Test Hint: (%d, %d), (%d, %d)", hint->row1, hint->col1, hint->row2, hint->col2);
 }
 
+void testValidMoveIndex() {
+    vector<vector<Cell>> grid = {
+        {0, 1, 0, 1, 2},
+        {1, 0, 1, 0, 1},
+        {2, 1, 2, 1, 0},
+        {1, 0, 1, 0, 1},
+        {0, 1, 0, 1, 2}
+    };
+    Match3Engine engine(5, 5, 3);
+    engine.setGrid(grid);
+    assert(engine.countValidMoves() > 0);
+
+    // Drive the index through incremental updates, then compare it with a
+    // freshly built one for the same board.
+    engine.applyGravity();
+    auto hint = engine.findHint();
+    assert(hint.has_value());
+    engine.swap(hint->row1, hint->col1, hint->row2, hint->col2);
+
+    vector<vector<Cell>> current(5, vector<Cell>(5));
+    for (int row = 0; row < 5; row++) {
+        for (int col = 0; col < 5; col++) {
+            current[row][col] = Cell(engine.getItem(col, row));
+        }
+    }
+    Match3Engine rebuilt(5, 5, 3);
+    rebuilt.setGrid(current);
+    assert(engine.countValidMoves() == rebuilt.countValidMoves());
+    assert(engine.hasValidMoves() == rebuilt.hasValidMoves());
+    auto incrementalHint = engine.findHint();
+    auto rebuiltHint = rebuilt.findHint();
+    assert(incrementalHint.has_value() == rebuiltHint.has_value());
+    if (incrementalHint) {
+        assert(incrementalHint->row1 == rebuiltHint->row1 && incrementalHint->col1 == rebuiltHint->col1);
+        assert(incrementalHint->row2 == rebuiltHint->row2 && incrementalHint->col2 == rebuiltHint->col2);
+    }
+    LOGD("✓ Valid move index test passed\n");
+}
+
 void testFourMatchHorizontal() {
     Match3Engine engine(6, 5, 3);
     engine.setGrid({
@@ -220,6 +488,39 @@ void test5Match() {
     }
 }
 
+void testVerticalPatterns() {
+    Match3Engine engine(5, 6, 4, 5);
+    engine.setGrid({
+        {0, 1, 2, 3, 1},
+        {0, 2, 3, 1, 1},
+        {0, 3, 1, 2, 1},
+        {1, 2, 3, 1, 1},
+        {2, 3, 1, 2, 1},
+        {3, 1, 2, 3, 2}
+    });
+    // One match per run, each covering its whole column. Pattern queries
+    // are const, so they work on an engine nobody may mutate.
+    const Match3Engine& readOnly = engine;
+    auto matches = readOnly.findAllMatchesWithPatterns();
+    int32_t pairs[16];
+    assert(readOnly.writeMatches(pairs, 8) == 8);
+    assert(matches.size() == 2);
+    assert(matches[0].pattern == MatchPattern::MATCH_3 && matches[0].cells.size() == 3);
+    assert(matches[0].cells.count({2, 0}) == 1);
+    assert(matches[1].pattern == MatchPattern::MATCH_5 && matches[1].cells.size() == 5);
+    assert(matches[1].specialType == SpecialType::COLOR_BOMB);
+
+    engine.processCascadeWithSpecials();
+    int bombs = 0;
+    for (int row = 0; row < 6; row++) {
+        for (int col = 0; col < 5; col++) {
+            bombs += engine.getSpecialType(row, col) == SpecialType::COLOR_BOMB;
+        }
+    }
+    assert(bombs == 1);
+    LOGD("✓ Vertical pattern test passed\n");
+}
+
 void testCascadeWithSpecials() {
     Match3Engine engine(6, 6, 4);
     engine.setGrid({
@@ -263,6 +564,1072 @@ void testCascadeWithSpecials() {
     }
 }
 
+void testSeededEngine() {
+    Match3Engine first(8, 8, 4, 1234);
+    Match3Engine second(8, 8, 4, 1234);
+    for (int row = 0; row < 8; row++) {
+        for (int col = 0; col < 8; col++) {
+            assert(first.getItem(col, row) == second.getItem(col, row));
+        }
+    }
+
+    // Restoring a saved generator state replays the same cascade refills.
+    RandomState saved = first.getRandomState();
+    Match3Engine replay = first;
+    int cascades = first.processCascadeWithSpecials();
+    replay.setRandomState(saved);
+    assert(replay.processCascadeWithSpecials() == cascades);
+    for (int row = 0; row < 8; row++) {
+        for (int col = 0; col < 8; col++) {
+            assert(first.getItem(col, row) == replay.getItem(col, row));
+        }
+    }
+
+    // Streams of one seed are reproducible and differ from each other.
+    Match3Random base(99);
+    Match3Random streamA = base.stream(1);
+    Match3Random streamB = base.stream(2);
+    Match3Random streamAgain = base.stream(1);
+    bool differs = false;
+    for (int i = 0; i < 16; i++) {
+        uint32_t a = streamA.next();
+        assert(a == streamAgain.next());
+        differs |= a != streamB.next();
+    }
+    assert(differs);
+    LOGD("✓ Seeded engine test passed\n");
+}
+
+void testRefillAvoidsMatches() {
+    // Every refilled cell is drawn from the colours that cannot complete a
+    // run, so a single cascade step never leaves a match behind.
+    Match3Engine engine(9, 9, 4, 77);
+    engine.setMinValidMovesAfterRefill(3);
+    for (int round = 0; round < 20; round++) {
+        vector<vector<Cell>> grid(9, vector<Cell>(9));
+        for (int row = 0; row < 9; row++) {
+            for (int col = 0; col < 9; col++) {
+                grid[row][col] = (row + col) % 4;
+            }
+        }
+        for (int col = 0; col < 9; col++) {
+            grid[round % 9][col] = 1;
+        }
+        engine.setGrid(grid);
+        assert(engine.processCascade() == 1);
+        assert(engine.findAllMatches().empty());
+        assert(engine.countValidMoves() >= 3);
+    }
+    LOGD("✓ Refill avoids matches test passed\n");
+}
+
+void testPackedCells() {
+    Match3Engine engine(9, 9, 6, 21);
+    vector<vector<Cell>> grid(9, vector<Cell>(9));
+    Match3Random rng(4);
+    for (auto& row: grid) {
+        for (Cell& cell: row) {
+            cell = Cell(rng.nextInt(7) - 1);
+            cell.specialType = static_cast<SpecialType>(rng.nextInt(5));
+        }
+    }
+    engine.setGrid(grid);
+
+    // 81 bytes round-trip to the same board.
+    PackedCell packed[81];
+    assert(sizeof(packed) == 81);
+    assert(engine.exportPacked(packed, 81));
+    assert(!engine.exportPacked(packed, 80));
+    Match3Engine restored(3, 3, 6, 1);
+    assert(restored.importPacked(packed, 9, 9));
+    assert(restored.getBoardHash() == engine.getBoardHash());
+    assert(restored.countValidMoves() == engine.countValidMoves());
+    assert(packed[0].type() == grid[0][0].type && packed[0].specialType() == grid[0][0].specialType);
+    assert(!packed[0].isBlocker());
+
+    // Colour 14 is the largest that fits; 15 is refused.
+    PackedCell cell;
+    assert(PackedCell::pack(Cell(14), cell) && cell.type() == 14);
+    assert(PackedCell::pack(Cell(), cell) && cell.type() == -1);
+    assert(!PackedCell::pack(Cell(15), cell) && cell.type() == -1);
+    grid[8][8] = Cell(15);
+    engine.setGrid(grid);
+    assert(!engine.exportPacked(packed, 81));
+    assert(!restored.importPacked(nullptr, 9, 9));
+
+    // A byte whose special bits are past COLOR_BOMB is refused as a whole.
+    uint64_t before = restored.getBoardHash();
+    packed[40].bits = static_cast<uint8_t>(2 | (7 << 4));
+    assert(!packed[40].hasKnownSpecial());
+    assert(!restored.importPacked(packed, 9, 9));
+    assert(restored.getBoardHash() == before);
+    packed[40].bits = static_cast<uint8_t>(2 | (static_cast<int>(SpecialType::COLOR_BOMB) << 4));
+    assert(restored.importPacked(packed, 9, 9) && restored.getSpecialType(4, 4) == SpecialType::COLOR_BOMB);
+    LOGD("✓ Packed cells test passed\n");
+}
+
+void testAttachedBoard() {
+    // The engine works in place on caller memory laid out as (type, special)
+    // int pairs, the same layout as a direct ByteBuffer from Java.
+    vector<int32_t> shared = {
+        0, 0,  1, 0,  2, 0,
+        1, 0,  1, 0,  1, 0,
+        2, 0,  0, 0,  1, 0
+    };
+    Match3Engine engine(3, 3, 3, 21);
+    assert(engine.attachBoard(reinterpret_cast<Cell*>(shared.data()), 3, 3));
+
+    int32_t pairs[18];
+    assert(engine.writeMatches(pairs, 9) == 3);
+    assert(pairs[0] == 1 && pairs[1] == 0 && pairs[4] == 1 && pairs[5] == 2);
+    assert(engine.writeChangedCells(pairs, 9) == 9);
+
+    engine.processCascade();
+    for (int row = 0; row < 3; row++) {
+        for (int col = 0; col < 3; col++) {
+            assert(shared[2 * (row * 3 + col)] == engine.getItem(col, row));
+        }
+    }
+    assert(engine.writeChangedCells(pairs, 9) > 0);
+    assert(engine.writeChangedCells(pairs, 9) == 0);
+
+    // Writes made by the owner of the memory are picked up on boardChanged().
+    shared[0] = shared[2] = shared[4] = 2;
+    engine.boardChanged();
+    assert(engine.writeMatches(pairs, 0) >= 3);
+
+    assert(engine.isBoardAttached());
+    engine.detachBoard();
+    assert(!engine.isBoardAttached());
+    shared[0] = 0;
+    assert(engine.getItem(0, 0) == 2);
+
+    // A grid of another size can't live in the buffer, so it detaches.
+    engine.attachBoard(reinterpret_cast<Cell*>(shared.data()), 3, 3);
+    engine.setGrid(vector<vector<Cell>>(2, vector<Cell>(2, Cell(1))));
+    assert(!engine.isBoardAttached());
+    assert(shared[0] == 0);
+
+    // Same cell count, other shape: an 8x8 buffer can't show a 4x16 board.
+    vector<int32_t> square(2 * 64, 1);
+    Match3Engine reshaped(8, 8, 3, 21);
+    assert(reshaped.attachBoard(reinterpret_cast<Cell*>(square.data()), 8, 8));
+    reshaped.setGrid(vector<vector<Cell>>(4, vector<Cell>(16, Cell(2))));
+    assert(!reshaped.isBoardAttached());
+    assert(square[0] == 1 && reshaped.getItem(15, 3) == 2);
+    LOGD("✓ Attached board test passed\n");
+}
+
+// Applies a swapAndResolve() event stream to `grid`, the board before the
+// move, checking its framing. Returns the number of steps; each ACTIVATED
+// event's (row, col, specialType, count) goes to `activations`.
+static int replayEvents(vector<vector<Cell>>& grid, const int32_t* events, int length,
+                        vector<array<int, 4>>* activations = nullptr) {
+    int pos = 0;
+    auto next = [&]() { return events[pos++]; };
+    int steps = 0;
+    while (pos < length) {
+        switch (static_cast<EventType>(next())) {
+            case EventType::SWAP: {
+                int row1 = next();
+                int col1 = next();
+                int row2 = next();
+                swap(grid[row1][col1], grid[row2][next()]);
+                break;
+            }
+            case EventType::STEP:
+                assert(next() == ++steps);
+                break;
+            case EventType::MATCHED:
+                for (int count = next(); count > 0; count--) {
+                    int row = next();
+                    grid[row][next()] = Cell();
+                }
+                break;
+            case EventType::ACTIVATED: {
+                array<int, 4> activation;
+                for (int& value: activation) {
+                    value = next();
+                }
+                for (int count = activation[3]; count > 0; count--) {
+                    int row = next();
+                    grid[row][next()] = Cell();
+                }
+                if (activations) {
+                    activations->push_back(activation);
+                }
+                break;
+            }
+            case EventType::SPECIAL: {
+                int row = next();
+                int col = next();
+                grid[row][col] = Cell(next());
+                grid[row][col].specialType = static_cast<SpecialType>(next());
+                break;
+            }
+            case EventType::FALLS: {
+                int col = next();
+                for (int count = next(); count > 0; count--) {
+                    int toRow = next();
+                    int distance = next();
+                    grid[toRow][col] = grid[toRow - distance][col];
+                    grid[toRow - distance][col] = Cell();
+                }
+                break;
+            }
+            case EventType::REFILLED:
+                for (int count = next(); count > 0; count--) {
+                    int row = next();
+                    int col = next();
+                    grid[row][col] = Cell(next());
+                }
+                break;
+            case EventType::END:
+                assert(next() == steps && pos == length);
+                break;
+        }
+    }
+    return steps;
+}
+
+void testSwapAndResolveEvents() {
+    vector<vector<Cell>> grid = {
+        {0, 1, 2, 3, 0},
+        {1, 2, 3, 0, 1},
+        {0, 0, 1, 0, 2},
+        {2, 3, 0, 1, 3},
+        {3, 1, 2, 3, 0}
+    };
+    Match3Engine engine(5, 5, 4, 3);
+    engine.setGrid(grid);
+    int32_t events[1024];
+    assert(engine.swapAndResolve(0, 0, 0, 1, events, 1024) == -1);
+
+    // Swapping (2, 2) and (2, 3) lines up three 0s. A buffer that is too
+    // small still reports the full length.
+    Match3Engine truncated = engine;
+    int length = engine.swapAndResolve(2, 2, 2, 3, events, 1024);
+    assert(length > 8 && length <= 1024);
+    int32_t small[8];
+    assert(truncated.swapAndResolve(2, 2, 2, 3, small, 8) == length);
+
+    // Replaying the stream on the pre-move board must give the final board.
+    int steps = replayEvents(grid, events, length);
+    assert(steps >= 1);
+    for (int row = 0; row < 5; row++) {
+        for (int col = 0; col < 5; col++) {
+            assert(grid[row][col].type == engine.getItem(col, row));
+            assert(grid[row][col].specialType == engine.getSpecialType(row, col));
+        }
+    }
+
+    // Swapping (0, 2) and (0, 3) makes an L of 0s: row 0 and column 2 share
+    // (0, 2), which is cleared, and reported, once.
+    Match3Engine corner(5, 5, 4, 3);
+    corner.setGrid({
+        {0, 0, 1, 0, 2},
+        {1, 2, 0, 3, 1},
+        {2, 3, 0, 1, 3},
+        {3, 1, 2, 2, 1},
+        {1, 2, 3, 3, 2}
+    });
+    assert(corner.swapAndResolve(0, 2, 0, 3, events, 1024) > 9);
+    assert(events[7] == int32_t(EventType::MATCHED) && events[8] == 5);
+    set<pair<int, int>> reported;
+    for (int index = 0; index < 5; index++) {
+        reported.insert({events[9 + 2 * index], events[10 + 2 * index]});
+    }
+    assert(reported == (set<pair<int, int>>{{0, 0}, {0, 1}, {0, 2}, {1, 2}, {2, 2}}));
+    LOGD("✓ Swap and resolve events test passed\n");
+}
+
+void testLocalSwapValidation() {
+    // A 40x40 board with no matches; swapping (0, 1) and (1, 1) lines up
+    // three 0s in row 0.
+    vector<vector<Cell>> grid(40, vector<Cell>(40));
+    for (int row = 0; row < 40; row++) {
+        for (int col = 0; col < 40; col++) {
+            grid[row][col] = Cell((row + 2 * col) % 4);
+        }
+    }
+    grid[1][1] = Cell(0);
+    Match3Engine engine(40, 40, 4, 3);
+    engine.setGrid(grid);
+    uint64_t hash = engine.getBoardHash();
+
+    // The second cell is bounds-checked too, and a swap that matches
+    // nothing leaves the board alone.
+    assert(!engine.swap(0, 0, -1, 0));
+    assert(!engine.swap(0, 0, 0, -1));
+    assert(!engine.swap(39, 39, 40, 39));
+    assert(!engine.swap(0, 2, 0, 3));
+    assert(engine.getBoardHash() == hash);
+
+    // The first step matches exactly the run through the swapped cells.
+    int32_t events[8192];
+    int length = engine.swapAndResolve(0, 1, 1, 1, events, 8192);
+    assert(length > 0 && length <= 8192);
+    assert(events[5] == int32_t(EventType::STEP) && events[6] == 1);
+    assert(events[7] == int32_t(EventType::MATCHED) && events[8] == 3);
+    for (int index = 0; index < 3; index++) {
+        assert(events[9 + 2 * index] == 0 && events[10 + 2 * index] == index);
+    }
+    assert(engine.findAllMatches().empty());
+
+    // Moving a hole next to two others lines up no colour, so it is no move.
+    Match3Engine holes(4, 3, 4, 3);
+    holes.setGrid({
+        {-1, -1, 0, 1},
+        {1, 2, -1, 3},
+        {2, 3, 1, 0}
+    });
+    assert(!holes.isValidSwap(0, 2, 1, 2));
+    assert(holes.countValidMoves() == 0);
+    assert(!holes.swap(0, 2, 1, 2));
+    assert(holes.getItem(2, 0) == 0);
+    LOGD("✓ Local swap validation test passed\n");
+}
+
+void testSpecialActivation() {
+    // No matches and no colour in three consecutive cells anywhere.
+    vector<vector<Cell>> base(6, vector<Cell>(6));
+    for (int row = 0; row < 6; row++) {
+        for (int col = 0; col < 6; col++) {
+            base[row][col] = Cell((row + 2 * col) % 4);
+        }
+    }
+    auto withSpecial = [](vector<vector<Cell>> grid, int row, int col, SpecialType special) {
+        grid[row][col].specialType = special;
+        return grid;
+    };
+    auto sameBoard = [](const vector<vector<Cell>>& grid, const Match3Engine& engine) {
+        for (int row = 0; row < 6; row++) {
+            for (int col = 0; col < 6; col++) {
+                assert(grid[row][col].type == engine.getItem(col, row));
+                assert(grid[row][col].specialType == engine.getSpecialType(row, col));
+            }
+        }
+    };
+    int32_t events[4096];
+    vector<array<int, 4>> activations;
+
+    // Swapping (2, 0) and (2, 1) matches column 0, rows 0-2. The striped
+    // item at (0, 0) clears row 0, which fires the wrapped one at (0, 4) in
+    // the same step.
+    vector<vector<Cell>> grid = withSpecial(base, 0, 0, SpecialType::STRIPED_HORIZONTAL);
+    grid = withSpecial(grid, 0, 4, SpecialType::WRAPPED);
+    grid[1][0] = Cell(0);
+    Match3Engine engine(6, 6, 4, 9);
+    engine.setGrid(grid);
+    int length = engine.swapAndResolve(2, 0, 2, 1, events, 4096);
+    assert(length > 0 && length <= 4096);
+    replayEvents(grid, events, length, &activations);
+    sameBoard(grid, engine);
+    assert(activations.size() >= 2);
+    assert((activations[0] == array<int, 4>{0, 0, int(SpecialType::STRIPED_HORIZONTAL), 5}));
+    assert((activations[1] == array<int, 4>{0, 4, int(SpecialType::WRAPPED), 3}));
+
+    // A colour bomb swapped with any item fires without a match and clears
+    // that item's colour: nine cells of colour 3, plus the bomb.
+    grid = withSpecial(base, 3, 3, SpecialType::COLOR_BOMB);
+    engine.setGrid(grid);
+    assert(engine.isValidSwap(3, 3, 3, 4) && engine.isValidSwap(3, 3, 2, 3));
+    activations.clear();
+    length = engine.swapAndResolve(3, 3, 3, 4, events, 4096);
+    assert(length > 0 && length <= 4096);
+    replayEvents(grid, events, length, &activations);
+    sameBoard(grid, engine);
+    assert((activations[0] == array<int, 4>{3, 4, int(SpecialType::COLOR_BOMB), 10}));
+
+    // Two striped items clear a row and a column through the second cell.
+    grid = withSpecial(base, 2, 2, SpecialType::STRIPED_HORIZONTAL);
+    grid = withSpecial(grid, 2, 3, SpecialType::STRIPED_VERTICAL);
+    engine.setGrid(grid);
+    assert(engine.hasValidMoves());
+    activations.clear();
+    length = engine.swapAndResolve(2, 2, 2, 3, events, 4096);
+    replayEvents(grid, events, length, &activations);
+    sameBoard(grid, engine);
+    assert((activations[0] == array<int, 4>{2, 3, int(SpecialType::STRIPED_HORIZONTAL), 11}));
+
+    // swap() takes special swaps too.
+    engine.setGrid(withSpecial(base, 0, 0, SpecialType::COLOR_BOMB));
+    assert(engine.swap(0, 0, 0, 1));
+    LOGD("✓ Special activation test passed\n");
+}
+
+void testLargeBoardSpecialChains() {
+    // Blasts on large boards used to feed special chains that ran into the
+    // cascade cap and left matches behind. Every move must end stable.
+    for (int size: {40, 64}) {
+        for (uint64_t seed = 0; seed < 4; seed++) {
+            Match3Engine engine(size, size, 5, seed);
+            engine.processCascadeWithSpecials();
+            assert(engine.findAllMatches().empty());
+            for (int move = 0; move < 20; move++) {
+                optional<Move> hint = engine.findHint();
+                if (!hint) {
+                    break;
+                }
+                assert(engine.swap(hint->row1, hint->col1, hint->row2, hint->col2));
+                assert(engine.findAllMatches().empty());
+            }
+        }
+    }
+    LOGD("✓ Large board special chains test passed\n");
+}
+
+void testSpawnStepLimit() {
+    // On default-sized boards cascades never reach the spawn limit, so
+    // play is the same, event for event, with the limit off.
+    vector<int32_t> limitedEvents(1 << 16);
+    vector<int32_t> unlimitedEvents(1 << 16);
+    for (int size: {8, 9}) {
+        for (uint64_t seed = 0; seed < 24; seed++) {
+            Match3Engine limited(size, size, size - 3, seed);
+            Match3Engine unlimited(size, size, size - 3, seed);
+            unlimited.setMaxSpawnSteps(0);
+            assert(limited.processCascadeWithSpecials() == unlimited.processCascadeWithSpecials());
+            for (int move = 0; move < 30; move++) {
+                optional<Move> hint = limited.findHint();
+                if (!hint) {
+                    break;
+                }
+                int length = limited.swapAndResolve(hint->row1, hint->col1, hint->row2, hint->col2,
+                                                    limitedEvents.data(), int(limitedEvents.size()));
+                assert(length > 0 && length <= int(limitedEvents.size()));
+                assert(unlimited.swapAndResolve(hint->row1, hint->col1, hint->row2, hint->col2,
+                                                unlimitedEvents.data(), int(unlimitedEvents.size())) == length);
+                assert(equal(limitedEvents.begin(), limitedEvents.begin() + length, unlimitedEvents.begin()));
+                assert(limited.getBoardHash() == unlimited.getBoardHash());
+            }
+        }
+    }
+
+    // On a large board later steps do spawn, unless the limit says not to.
+    vector<int32_t> events(1 << 20);
+    int lateSpawns[2] = {0, 0};
+    for (int limit: {0, 1}) {
+        Match3Engine engine(40, 40, 5, 5);
+        engine.setMaxSpawnSteps(limit);
+        engine.processCascadeWithSpecials();
+        for (int move = 0; move < 20; move++) {
+            optional<Move> hint = engine.findHint();
+            if (!hint) {
+                break;
+            }
+            int length = engine.swapAndResolve(hint->row1, hint->col1, hint->row2, hint->col2,
+                                               events.data(), int(events.size()));
+            assert(length > 0 && length <= int(events.size()));
+            assert(engine.findAllMatches().empty());
+            int step = 0;
+            for (int pos = 0; pos < length;) {
+                switch (static_cast<EventType>(events[pos])) {
+                    case EventType::STEP:
+                        step = events[pos + 1];
+                        pos += 2;
+                        break;
+                    case EventType::SPECIAL:
+                        lateSpawns[limit] += step > 1;
+                        pos += 5;
+                        break;
+                    case EventType::MATCHED:
+                        pos += 2 + 2 * events[pos + 1];
+                        break;
+                    case EventType::ACTIVATED:
+                        pos += 5 + 2 * events[pos + 4];
+                        break;
+                    case EventType::FALLS:
+                        pos += 3 + 2 * events[pos + 2];
+                        break;
+                    case EventType::REFILLED:
+                        pos += 2 + 3 * events[pos + 1];
+                        break;
+                    default:
+                        pos += events[pos] == int32_t(EventType::SWAP) ? 5 : 2;
+                        break;
+                }
+            }
+        }
+    }
+    assert(lateSpawns[0] > 0 && lateSpawns[1] == 0);
+    LOGD("✓ Spawn step limit test passed\n");
+}
+
+void testAllocationFreeCascade() {
+    vector<vector<Cell>> grid(9, vector<Cell>(9));
+    for (int row = 0; row < 9; row++) {
+        for (int col = 0; col < 9; col++) {
+            grid[row][col] = (row * 2 + col) % 4;
+        }
+    }
+    grid[4][3] = grid[4][4] = grid[4][5] = 1;
+    grid[2][0] = grid[3][0] = 3;
+
+    // Warm-up rounds size the engine's scratch buffers; after that a cascade
+    // step must not touch the heap.
+    Match3Engine engine(9, 9, 4, 8);
+    int32_t events[4096];
+    long allocations = 0;
+    for (int round = 0; round < 40; round++) {
+        engine.setGrid(grid);
+        countingAllocations = round >= 20;
+        allocationCount = 0;
+        engine.processCascadeWithSpecials();
+        engine.processCascade();
+        engine.swapAndResolve(3, 0, 4, 0, events, 4096);
+        engine.countValidMoves();
+        countingAllocations = false;
+        allocations += allocationCount;
+    }
+    assert(allocations == 0);
+    LOGD("✓ Allocation-free cascade test passed\n");
+}
+
+template<int W, int H, int Colors>
+void checkFixedBoardAgainstEngine(uint64_t seed) {
+    Match3Random rng(seed);
+    Match3Board<W, H, Colors> board;
+    board.fill(rng);
+    vector<vector<Cell>> grid(H, vector<Cell>(W));
+    for (int row = 0; row < H; row++) {
+        for (int col = 0; col < W; col++) {
+            grid[row][col] = board.get(row, col);
+        }
+    }
+    Match3Engine engine(W, H, Colors);
+    engine.setGrid(grid);
+
+    auto matches = engine.findAllMatches();
+    typename Match3Board<W, H, Colors>::Mask mask = board.findMatches();
+    for (int row = 0; row < H; row++) {
+        for (int col = 0; col < W; col++) {
+            assert(((mask[row] >> col) & 1) == matches.count({row, col}));
+        }
+    }
+    assert(board.countValidMoves() == engine.countValidMoves());
+    int validSwaps = 0;
+    for (int row = 0; row < H; row++) {
+        for (int col = 0; col < W; col++) {
+            bool right = board.isValidSwap(row, col, row, col + 1);
+            bool down = board.isValidSwap(row, col, row + 1, col);
+            assert(right == engine.isValidSwap(row, col, row, col + 1));
+            assert(down == engine.isValidSwap(row, col, row + 1, col));
+            validSwaps += right + down;
+        }
+    }
+    assert(validSwaps == board.countValidMoves());
+
+    board.clear(mask);
+    board.applyGravity();
+    for (const auto& cell: matches) {
+        grid[cell.first][cell.second] = Cell();
+    }
+    engine.setGrid(grid);
+    engine.applyGravity();
+    for (int row = 0; row < H; row++) {
+        for (int col = 0; col < W; col++) {
+            assert(board.get(row, col) == engine.getItem(col, row));
+        }
+    }
+
+    board.refill(rng);
+    board.processCascade(rng);
+    assert(!board.hasMatches());
+
+    // A rejected swap leaves the board alone; an accepted one resolves.
+    assert(!board.swap(0, 0, 1, 1, rng));
+    for (int row = 0; row < H; row++) {
+        for (int col = 0; col + 1 < W; col++) {
+            if (board.isValidSwap(row, col, row, col + 1)) {
+                assert(board.swap(row, col, row, col + 1, rng));
+                assert(!board.hasMatches());
+                return;
+            }
+            int before = board.get(row, col);
+            assert(!board.swap(row, col, row, col + 1, rng) && board.get(row, col) == before);
+        }
+    }
+}
+
+void testFixedSizeBoard() {
+    static_assert(sizeof(Match3Board<8, 8, 6>::Row) == 1, "8 columns fit a byte");
+    static_assert(sizeof(Match3Board<9, 9, 6>::Row) == 2, "9 columns need 16 bits");
+    for (uint64_t seed = 0; seed < 50; seed++) {
+        checkFixedBoardAgainstEngine<8, 8, 4>(seed);
+        checkFixedBoardAgainstEngine<9, 9, 5>(seed);
+        checkFixedBoardAgainstEngine<7, 10, 3>(seed);
+    }
+    LOGD("✓ Fixed-size board test passed\n");
+}
+
+// Every board in a batch must step exactly like a Match3Board on the same
+// PCG stream, including a batch size that leaves a partial bitset word.
+void testBoardBatch() {
+    const int COUNT = 70;
+    const uint64_t SEED = 23;
+    BoardBatch batch(8, 8, 4, COUNT, SEED);
+    vector<Match3Board<8, 8, 4>> boards(COUNT);
+    vector<Match3Random> rngs;
+    for (int board = 0; board < COUNT; board++) {
+        rngs.emplace_back(SEED, board);
+        boards[board].fill(rngs[board]);
+    }
+    auto sameBoards = [&]() {
+        for (int board = 0; board < COUNT; board++) {
+            for (int row = 0; row < 8; row++) {
+                for (int col = 0; col < 8; col++) {
+                    assert(batch.get(board, row, col) == boards[board].get(row, col));
+                }
+            }
+        }
+    };
+    batch.fill();
+    sameBoards();
+
+    batch.processCascade();
+    for (int board = 0; board < COUNT; board++) {
+        assert(batch.cascadeSteps(board) == boards[board].processCascade(rngs[board]));
+    }
+    sameBoards();
+
+    Match3Random moveRng(5);
+    vector<Move> moves(COUNT);
+    vector<int> results(COUNT);
+    for (int round = 0; round < 20; round++) {
+        for (Move& move: moves) {
+            move.row1 = moveRng.nextInt(8);
+            move.col1 = moveRng.nextInt(8);
+            bool horizontal = moveRng.nextInt(2) == 0;
+            move.row2 = move.row1 + (horizontal ? 0 : 1);
+            move.col2 = move.col1 + (horizontal ? 1 : 0);
+        }
+        moves[0].row1 = -1;
+        batch.applyMoves(moves.data(), results.data());
+
+        for (int board = 0; board < COUNT; board++) {
+            const Move& move = moves[board];
+            Match3Board<8, 8, 4>& reference = boards[board];
+            int expected = -1;
+            if (move.row1 >= 0 && move.row2 < 8 && move.col2 < 8) {
+                int first = reference.get(move.row1, move.col1);
+                reference.set(move.row1, move.col1, reference.get(move.row2, move.col2));
+                reference.set(move.row2, move.col2, first);
+                if (reference.hasMatches()) {
+                    expected = reference.processCascade(rngs[board]);
+                }
+                else {
+                    reference.set(move.row2, move.col2, reference.get(move.row1, move.col1));
+                    reference.set(move.row1, move.col1, first);
+                }
+            }
+            assert(results[board] == expected);
+        }
+        sameBoards();
+    }
+    assert(results[0] == -1);
+
+    // A board snapshots to 64 bytes and loads into another lane unchanged.
+    PackedCell snapshot[64];
+    assert(batch.exportPacked(3, snapshot));
+    batch.importPacked(69, snapshot);
+    for (int cell = 0; cell < 64; cell++) {
+        assert(batch.get(69, cell / 8, cell % 8) == batch.get(3, cell / 8, cell % 8));
+    }
+    LOGD("✓ Board batch test passed\n");
+}
+
+void testSharedRefillRule() {
+    // One seeded board with its matches cleared and dropped, refilled by
+    // each of the three from the same generator state.
+    const uint64_t SEED = 31;
+    BoardBatch batch(8, 8, 4, 1, SEED);
+    batch.fill();
+    Match3Random rng(SEED, 0);
+    Match3Board<8, 8, 4> board;
+    board.fill(rng);
+    board.clear(board.findMatches());
+    board.applyGravity();
+    batch.findMatches();
+    batch.clearMatches();
+    batch.applyGravity();
+
+    vector<vector<Cell>> grid(8, vector<Cell>(8));
+    int holes = 0;
+    for (int row = 0; row < 8; row++) {
+        for (int col = 0; col < 8; col++) {
+            grid[row][col] = Cell(board.get(row, col));
+            holes += board.get(row, col) == Match3Board<8, 8, 4>::EMPTY;
+        }
+    }
+    assert(holes > 0);
+    Match3Engine engine(8, 8, 4);
+    engine.setGrid(grid);
+    engine.setRandomState(rng.getState());
+
+    board.refill(rng);
+    batch.refill();
+    engine.refillSmart();
+    for (int row = 0; row < 8; row++) {
+        for (int col = 0; col < 8; col++) {
+            assert(board.get(row, col) >= 0);
+            assert(batch.get(0, row, col) == board.get(row, col));
+            assert(engine.getItem(col, row) == board.get(row, col));
+        }
+    }
+    LOGD("✓ Shared refill rule test passed\n");
+}
+
+void testEngineStats() {
+    Match3Engine engine(9, 9, 4, 17);
+    engine.resetStats();
+    int cascades = 0;
+    for (int round = 0; round < 5; round++) {
+        engine.processCascadeWithSpecials();
+        engine.processCascade();
+        cascades += 2;
+    }
+    engine.shuffle();
+    EngineStats stats = engine.getStats();
+
+#ifdef MATCH3_ENABLE_STATS
+    assert(stats.enabled);
+    assert(stats.phases[static_cast<int>(StatPhase::DETECTION)].calls >= uint64_t(cascades));
+    assert(stats.shuffleCalls == 1 && stats.shuffleAttempts >= 1);
+    uint64_t recorded = 0;
+    for (uint64_t depth: stats.cascadeDepths) {
+        recorded += depth;
+    }
+    assert(recorded == uint64_t(cascades));
+    engine.resetStats();
+    assert(engine.getStats().shuffleCalls == 0);
+#else
+    // Compiled out: nothing is recorded.
+    assert(!stats.enabled && stats.shuffleCalls == 0 && cascades > 0);
+    for (const PhaseStats& phase: stats.phases) {
+        assert(phase.calls == 0 && phase.nanos == 0);
+    }
+#endif
+    LOGD("✓ Engine stats test passed\n");
+}
+
+void testLogRingBuffer() {
+    // The counts below need the ring to themselves.
+    bool flusherWasRunning = stopLogFlusher();
+    flushLogBuffer();
+    uint64_t droppedBefore = droppedLogCount();
+    match3Log(MATCH3_LOG_LEVEL_DEBUG, "queued %d", 1);
+    assert(flushLogBuffer() == 1);
+
+    // A full ring drops instead of blocking the caller.
+    for (int i = 0; i < 300; i++) {
+        match3Log(MATCH3_LOG_LEVEL_DEBUG, "burst %d", i);
+    }
+    assert(flushLogBuffer() == 256);
+    assert(droppedLogCount() - droppedBefore == 300 - 256);
+
+    startLogFlusher(1);
+    match3Log(MATCH3_LOG_LEVEL_INFO, "from the flusher thread");
+    assert(stopLogFlusher());
+    assert(flushLogBuffer() == 0);
+    if (flusherWasRunning) {
+        startLogFlusher();
+    }
+    LOGD("✓ Log ring buffer test passed\n");
+}
+
+void testSessionRegistry() {
+    SessionHandle first = createSession(8, 8, 5, 1);
+    SessionHandle second = createSession(8, 8, 5, 1);
+    assert(first != 0 && second != 0 && first != second);
+    assert(findSession(0) == nullptr);
+
+    // Each session on its own thread; same seed, same moves, same boards.
+    auto play = [](SessionHandle handle) {
+        Match3Engine& engine = findSession(handle)->engine;
+        for (int move = 0; move < 20; move++) {
+            optional<Move> hint = engine.findHint();
+            if (!hint) {
+                break;
+            }
+            engine.swap(hint->row1, hint->col1, hint->row2, hint->col2);
+        }
+    };
+    thread worker(play, second);
+    play(first);
+    worker.join();
+    for (int row = 0; row < 8; row++) {
+        for (int col = 0; col < 8; col++) {
+            assert(findSession(first)->engine.getItem(col, row) == findSession(second)->engine.getItem(col, row));
+        }
+    }
+
+    // A destroyed handle stays dead even after its slot is reused.
+    assert(destroySession(first));
+    assert(findSession(first) == nullptr);
+    assert(!destroySession(first));
+    SessionHandle reused = createSession(4, 4, 3, 2);
+    assert(findSession(first) == nullptr);
+    assert(findSession(reused) != nullptr);
+    assert(destroySession(reused));
+
+    // Stale lookups racing create and destroy on the same slot never
+    // resolve, and never read a session that may be freed.
+    SessionHandle stale = createSession(4, 4, 3, 3);
+    assert(destroySession(stale));
+    atomic<bool> churning{true};
+    thread churn([&]() {
+        for (int round = 0; round < 20000; round++) {
+            SessionHandle handle = createSession(4, 4, 3, 3);
+            assert(findSession(handle) != nullptr);
+            destroySession(handle);
+        }
+        churning = false;
+    });
+    thread lookup([&]() {
+        while (churning) {
+            assert(findSession(stale) == nullptr);
+        }
+    });
+    while (churning) {
+        assert(findSession(stale) == nullptr);
+    }
+    churn.join();
+    lookup.join();
+
+    assert(destroySession(second));
+    assert(sessionCount() == 0);
+    LOGD("✓ Session registry test passed\n");
+}
+
+void testFindBestMove() {
+    Match3Engine engine(8, 8, 5, 31);
+    engine.processCascade();
+    vector<Move> moves = engine.findValidMoves();
+    assert(int(moves.size()) == engine.countValidMoves());
+    assert(moves.front().row1 == engine.findHint()->row1 && moves.front().col1 == engine.findHint()->col1);
+
+    BestMoveOptions options;
+    options.rollouts = 8;
+    options.seed = 3;
+    WorkStealingPool single(1);
+    WorkStealingPool parallel(4);
+    vector<MoveScore> serial = findBestMove(engine, single, options);
+    vector<MoveScore> ranked = findBestMove(engine, parallel, options);
+    assert(ranked.size() == moves.size());
+    for (size_t i = 0; i < ranked.size(); i++) {
+        // Rollouts are seeded per task, so the thread count does not matter.
+        assert(ranked[i].score == serial[i].score && ranked[i].move.row1 == serial[i].move.row1 &&
+               ranked[i].move.col1 == serial[i].move.col1 && ranked[i].move.row2 == serial[i].move.row2);
+        assert(ranked[i].rollouts == 8 && ranked[i].depth >= 1 && ranked[i].cleared >= 3);
+        assert(i == 0 || ranked[i - 1].score >= ranked[i].score);
+    }
+    // The engine itself is untouched.
+    assert(engine.findValidMoves().size() == moves.size());
+
+    // Large boards make event streams longer than a worker's first buffer;
+    // those rollouts must still count in full whichever thread runs them.
+    Match3Engine large(40, 40, 5, 7);
+    large.processCascade();
+    options.rollouts = 2;
+    vector<MoveScore> largeSerial = findBestMove(large, single, options);
+    vector<MoveScore> largeRanked = findBestMove(large, parallel, options);
+    assert(largeRanked.size() == largeSerial.size());
+    for (size_t i = 0; i < largeRanked.size(); i++) {
+        assert(largeRanked[i].score == largeSerial[i].score && largeRanked[i].cleared == largeSerial[i].cleared);
+        assert(largeRanked[i].move.row1 == largeSerial[i].move.row1 && largeRanked[i].move.col1 == largeSerial[i].move.col1 &&
+               largeRanked[i].move.row2 == largeSerial[i].move.row2 && largeRanked[i].move.col2 == largeSerial[i].move.col2);
+    }
+
+    // Every cleared cell is either refilled or left holding a new special,
+    // so a move whose L shares a cell between its runs scores that cell once.
+    Match3Engine corner(5, 5, 4, 3);
+    corner.setGrid({
+        {0, 0, 1, 0, 2},
+        {1, 2, 0, 3, 1},
+        {2, 3, 0, 1, 3},
+        {3, 1, 2, 2, 1},
+        {1, 2, 3, 3, 2}
+    });
+    options.rollouts = 1;
+    bool sawCorner = false;
+    for (const MoveScore& score: findBestMove(corner, single, options)) {
+        Match3Engine replay = corner;
+        replay.setSeed(options.seed, 0);
+        int32_t events[4096];
+        int length = replay.swapAndResolve(score.move.row1, score.move.col1, score.move.row2, score.move.col2,
+                                           events, 4096);
+        assert(length > 0 && length <= 4096);
+        int emptied = 0;
+        int pos = 0;
+        while (pos < length) {
+            EventType type = static_cast<EventType>(events[pos]);
+            if (type == EventType::SWAP || type == EventType::SPECIAL) {
+                emptied += type == EventType::SPECIAL;
+                pos += 5;
+            } else if (type == EventType::STEP || type == EventType::END) {
+                pos += 2;
+            } else if (type == EventType::MATCHED) {
+                pos += 2 + 2 * events[pos + 1];
+            } else if (type == EventType::ACTIVATED) {
+                pos += 5 + 2 * events[pos + 4];
+            } else if (type == EventType::FALLS) {
+                pos += 3 + 2 * events[pos + 2];
+            } else {
+                emptied += events[pos + 1];
+                pos += 2 + 3 * events[pos + 1];
+            }
+        }
+        assert(score.rollouts == 1 && score.cleared == emptied);
+        sawCorner |= score.move.row1 == 0 && score.move.col1 == 2 && score.move.row2 == 0 && score.move.col2 == 3;
+    }
+    assert(sawCorner);
+
+    // A budget that runs out early still ranks every move.
+    options.rollouts = 1 << 12;
+    options.budgetMicros = 20000;
+    vector<MoveScore> budgeted = findBestMove(engine, parallel, options);
+    assert(budgeted.size() == moves.size() && budgeted.front().rollouts > 0);
+    assert(budgeted.front().rollouts < options.rollouts);
+
+    atomic<int> sum{0};
+    parallel.parallelFor(1000, [&](int index, int worker) {
+        assert(worker >= 0 && worker < parallel.size());
+        sum += index;
+    });
+    assert(sum == 999 * 1000 / 2);
+    LOGD("✓ Best move search test passed\n");
+}
+
+static uint64_t hashFromScratch(Match3Engine& engine, int width, int height) {
+    uint64_t hash = 0;
+    for (int row = 0; row < height; row++) {
+        for (int col = 0; col < width; col++) {
+            hash ^= zobristKey(row * width + col, engine.getItem(col, row),
+                               static_cast<int>(engine.getSpecialType(row, col)));
+        }
+    }
+    return hash;
+}
+
+void testBoardHash() {
+    Match3Engine engine(8, 8, 5, 41);
+    assert(engine.getBoardHash() == hashFromScratch(engine, 8, 8));
+    vector<int32_t> events(1 << 14);
+    for (int move = 0; move < 30; move++) {
+        optional<Move> hint = engine.findHint();
+        if (!hint) {
+            assert(engine.shuffle());
+            continue;
+        }
+        engine.swapAndResolve(hint->row1, hint->col1, hint->row2, hint->col2, events.data(), events.size());
+        // Every write (swap, removal, specials, gravity, refill) kept it exact.
+        assert(engine.getBoardHash() == hashFromScratch(engine, 8, 8));
+    }
+
+    // Same cells, same hash, however they got there; one change differs.
+    Match3Engine copy(8, 8, 5, 99);
+    vector<vector<Cell>> grid(8, vector<Cell>(8));
+    for (int row = 0; row < 8; row++) {
+        for (int col = 0; col < 8; col++) {
+            grid[row][col].type = engine.getItem(col, row);
+            grid[row][col].specialType = engine.getSpecialType(row, col);
+        }
+    }
+    copy.setGrid(grid);
+    assert(copy.getBoardHash() == engine.getBoardHash());
+    grid[0][0].specialType = grid[0][0].specialType == SpecialType::NONE ? SpecialType::WRAPPED : SpecialType::NONE;
+    copy.setGrid(grid);
+    assert(copy.getBoardHash() != engine.getBoardHash());
+
+    TranspositionTable table(1000);
+    assert(table.size() == 1024);
+    uint64_t value = 0;
+    assert(!table.probe(engine.getBoardHash(), value));
+    table.store(engine.getBoardHash(), 42);
+    assert(table.probe(engine.getBoardHash(), value) && value == 42);
+    assert(!table.probe(engine.getBoardHash() ^ 1024, value));
+    assert(table.insert(copy.getBoardHash()) && !table.insert(copy.getBoardHash()));
+
+    // Readers racing writers on the same slots see a stored value or a
+    // miss, never another hash's value.
+    atomic<bool> mismatched{false};
+    auto hammer = [&](uint64_t salt) {
+        for (uint64_t i = 0; i < 20000; i++) {
+            uint64_t hash = zobristKey(int(i % 64), int(salt), 0);
+            table.store(hash, hash * 3);
+            uint64_t found;
+            uint64_t other = zobristKey(int(i % 64), int(salt ^ 1), 0);
+            if (table.probe(other, found) && found != other * 3) {
+                mismatched = true;
+            }
+        }
+    };
+    thread first(hammer, 0);
+    thread second(hammer, 1);
+    first.join();
+    second.join();
+    assert(!mismatched);
+    table.clear();
+    assert(!table.probe(engine.getBoardHash(), value));
+    LOGD("✓ Board hash test passed\n");
+}
+
+void testConcurrentSwapEvaluation() {
+    Match3Engine engine(9, 9, 5, 57);
+    engine.processCascade();
+    vector<Move> swaps;
+    for (int row = 0; row < 9; row++) {
+        for (int col = 0; col < 9; col++) {
+            if (col + 1 < 9) {
+                swaps.push_back({row, col, row, col + 1});
+            }
+            if (row + 1 < 9) {
+                swaps.push_back({row, col, row + 1, col});
+            }
+        }
+    }
+
+    // The what-if answer agrees with actually swapping on a copy.
+    vector<bool> expected;
+    for (const Move& move: swaps) {
+        Match3Engine copy = engine;
+        expected.push_back(engine.isValidSwap(move.row1, move.col1, move.row2, move.col2));
+        assert(expected.back() == copy.swap(move.row1, move.col1, move.row2, move.col2));
+    }
+    assert(!engine.isValidSwap(0, 0, 1, 1) && !engine.isValidSwap(0, 8, 0, 9));
+
+    // Many readers on one board: same answers, and the board never moves.
+    const Match3Engine& shared = engine;
+    uint64_t hash = shared.getBoardHash();
+    vector<Move> validMoves = shared.findValidMoves();
+    atomic<bool> mismatched{false};
+    auto evaluate = [&]() {
+        for (int round = 0; round < 20; round++) {
+            for (size_t index = 0; index < swaps.size(); index++) {
+                const Move& move = swaps[index];
+                if (shared.isValidSwap(move.row1, move.col1, move.row2, move.col2) != expected[index]) {
+                    mismatched = true;
+                }
+            }
+            if (shared.findValidMoves().size() != validMoves.size() || !shared.findMatchMask().empty() ||
+                shared.countValidMoves() != int(validMoves.size()) || shared.getBoardHash() != hash) {
+                mismatched = true;
+            }
+        }
+    };
+    vector<thread> readers;
+    for (int reader = 0; reader < 4; reader++) {
+        readers.emplace_back(evaluate);
+    }
+    for (thread& reader: readers) {
+        reader.join();
+    }
+    assert(!mismatched);
+    assert(shared.getBoardHash() == hash);
+    LOGD("✓ Concurrent swap evaluation test passed\n");
+}
+
 void testShuffle() {
     Match3Engine engine(3, 3, 3);
     engine.setGrid({
@@ -271,23 +1638,62 @@ void testShuffle() {
         {0, 2, 0}
     });
     assert(engine.hasValidMoves() == false);
-    engine.shuffle();
+    assert(engine.shuffle());
     assert(engine.hasValidMoves() == true);
+    assert(engine.findAllMatches().empty());
+
+    // Two colours on a dense board: still bounded, no matches left behind.
+    Match3Engine dense(8, 8, 2, 5);
+    assert(dense.shuffle(4));
+    assert(dense.findAllMatches().empty());
+    assert(dense.countValidMoves() >= 4);
+
+    // No colour has three items, so no arrangement has a move.
+    engine.setGrid({
+        {0, 1},
+        {1, 0}
+    });
+    assert(!engine.shuffle());
+    assert(engine.getItem(0, 0) == 0 && engine.getItem(1, 0) == 1);
     LOGD("✓ Shuffle created valid moves\n");
 }
 
 void android_main(struct android_app* state) {
     testHorizontalMatch();
+    testMatchMask();
+    testWideBoardMatches();
     testGravity();
     testCascade();
+    testCascadeLeavesNoMatches();
     testHasValidMoves();
     testNoValidMoves();
     testMultipleValidMoves();
     testFindHint();
+    testValidMoveIndex();
     testFourMatchHorizontal();
     testLMatch();
     testTMatch();
     test5Match();
+    testVerticalPatterns();
     testCascadeWithSpecials();
+    testSeededEngine();
+    testRefillAvoidsMatches();
+    testAttachedBoard();
+    testPackedCells();
+    testSwapAndResolveEvents();
+    testLocalSwapValidation();
+    testSpecialActivation();
+    testLargeBoardSpecialChains();
+    testSpawnStepLimit();
+    testAllocationFreeCascade();
+    testFixedSizeBoard();
+    testBoardBatch();
+    testSharedRefillRule();
+    testEngineStats();
+    testLogRingBuffer();
+    testSessionRegistry();
+    testFindBestMove();
+    testBoardHash();
+    testConcurrentSwapEvaluation();
     testShuffle();
 }
@@ -0,0 +1,280 @@
+#include "match3_batch.h"
+#include <algorithm>
+#include <cstdlib>
+#include "match3_bitboard.h"
+#include "match3_simd.h"
+using namespace std;
+
+BoardBatch::BoardBatch(int width, int height, int colors, int count, uint64_t seed):
+    width(width), height(height), colors(colors), count(count),
+    cellCount(width * height),
+    blockCount((count + BLOCK - 1) / BLOCK),
+    cells(size_t(blockCount) * cellCount * BLOCK, EMPTY),
+    matched(size_t(blockCount) * cellCount),
+    anyMatched(blockCount),
+    active(blockCount),
+    horizontalStarts(cellCount),
+    verticalStarts(cellCount),
+    steps(count) {
+    rngs.reserve(count);
+    for (int board = 0; board < count; board++) {
+        rngs.emplace_back(seed, board);
+    }
+}
+
+bool BoardBatch::exportPacked(int board, PackedCell* out) const {
+    const int cellCount = width * height;
+    for (int cell = 0; cell < cellCount; cell++) {
+        if (get(board, cell / width, cell % width) >= PackedCell::MAX_COLORS) {
+            return false;
+        }
+    }
+    for (int cell = 0; cell < cellCount; cell++) {
+        PackedCell::pack(Cell(get(board, cell / width, cell % width)), out[cell]);
+    }
+    return true;
+}
+
+void BoardBatch::importPacked(int board, const PackedCell* in) {
+    const int cellCount = width * height;
+    for (int cell = 0; cell < cellCount; cell++) {
+        set(board, cell / width, cell % width, in[cell].type());
+    }
+}
+
+void BoardBatch::fill() {
+    for (int board = 0; board < count; board++) {
+        for (int row = 0; row < height; row++) {
+            for (int col = 0; col < width; col++) {
+                set(board, row, col, rngs[board].nextInt(colors));
+            }
+        }
+    }
+}
+
+void BoardBatch::activateAll() {
+    for (int block = 0; block < blockCount; block++) {
+        int boards = min(BLOCK, count - block * BLOCK);
+        active[block] = boards == BLOCK ? ~uint64_t(0) : bit(boards) - 1;
+    }
+}
+
+int BoardBatch::findMatches() {
+    activateAll();
+    return scanMatches();
+}
+
+// A block's lanes are one byte plane of cellCount * 64 entries, so the run
+// kernel compares each cell with the cell one (or one row) further on for
+// all boards in a single call. Bit i of the result is (cell i / 64, lane
+// i % 64), which makes word `cell` of the output that cell's lane mask.
+int BoardBatch::scanMatches() {
+    const SimdKernels& kernels = simdKernels();
+    int boards = 0;
+    for (int block = 0; block < blockCount; block++) {
+        anyMatched[block] = 0;
+        uint64_t* words = &matched[size_t(block) * cellCount];
+        std::fill(words, words + cellCount, 0);
+        if (active[block] == 0) {
+            continue;
+        }
+
+        const int8_t* types = lanes(block, 0);
+        std::fill(horizontalStarts.begin(), horizontalStarts.end(), 0);
+        std::fill(verticalStarts.begin(), verticalStarts.end(), 0);
+        if (cellCount > 2) {
+            kernels.runStarts(types, types + BLOCK, types + 2 * BLOCK,
+                              (cellCount - 2) * BLOCK, horizontalStarts.data());
+        }
+        if (height > 2) {
+            kernels.runStarts(types, types + width * BLOCK, types + 2 * width * BLOCK,
+                              (cellCount - 2 * width) * BLOCK, verticalStarts.data());
+        }
+
+        // A run starting at a cell covers it and the next two cells; runs
+        // that would wrap past the end of a row are not runs.
+        for (int row = 0; row < height; row++) {
+            for (int col = 0; col < width; col++) {
+                int cell = row * width + col;
+                uint64_t horizontal = col + 2 < width ? horizontalStarts[cell] & active[block] : 0;
+                uint64_t vertical = row + 2 < height ? verticalStarts[cell] & active[block] : 0;
+                words[cell] |= horizontal | vertical;
+                if (horizontal) {
+                    words[cell + 1] |= horizontal;
+                    words[cell + 2] |= horizontal;
+                }
+                if (vertical) {
+                    words[cell + width] |= vertical;
+                    words[cell + 2 * width] |= vertical;
+                }
+                anyMatched[block] |= horizontal | vertical;
+            }
+        }
+        boards += popcount64(anyMatched[block]);
+    }
+    return boards;
+}
+
+bool BoardBatch::hasMatches(int board) const {
+    return (anyMatched[board / BLOCK] >> (board % BLOCK)) & 1;
+}
+
+void BoardBatch::clearMatches() {
+    for (int block = 0; block < blockCount; block++) {
+        if (anyMatched[block] == 0) {
+            continue;
+        }
+        for (int cell = 0; cell < cellCount; cell++) {
+            int8_t* types = lanes(block, cell);
+            for (uint64_t word = matchWord(block, cell); word; word &= word - 1) {
+                types[lowestBit(word)] = EMPTY;
+            }
+        }
+    }
+}
+
+void BoardBatch::applyGravity() {
+    for (int block = 0; block < blockCount; block++) {
+        dropBlock(block);
+    }
+}
+
+// Each sweep walks a column bottom-up and pulls the cell above into an
+// empty one, which moves everything above the lowest gap down by one. The
+// body is branch-free over the block's 64 boards (EMPTY is all ones, so the
+// sign bit selects); a column is swept again until nothing moves, which is
+// once per gap in its worst board.
+void BoardBatch::dropBlock(int block) {
+    for (int col = 0; col < width; col++) {
+        bool moved = true;
+        while (moved) {
+            int8_t falls = 0;
+            for (int row = height - 1; row > 0; row--) {
+                int8_t* lower = lanes(block, row * width + col);
+                int8_t* upper = lower - width * BLOCK;
+                for (int lane = 0; lane < BLOCK; lane++) {
+                    int8_t below = lower[lane];
+                    int8_t above = upper[lane];
+                    int8_t hole = static_cast<int8_t>(below >> 7);
+                    lower[lane] = static_cast<int8_t>((above & hole) | (below & ~hole));
+                    upper[lane] = static_cast<int8_t>(above | hole);
+                    falls |= static_cast<int8_t>(hole & ~(above >> 7));
+                }
+            }
+            moved = falls != 0;
+        }
+    }
+}
+
+void BoardBatch::refill() {
+    for (int board = 0; board < count; board++) {
+        refillBoard(board);
+    }
+}
+
+// Same draw order and colour rule as Match3Board::refill.
+void BoardBatch::refillBoard(int board) {
+    const uint64_t allColors = colors == 64 ? ~uint64_t(0) : bit(colors) - 1;
+    int8_t* types = lanes(board / BLOCK, 0) + board % BLOCK;
+    // After gravity the holes sit at the top of their columns, so the first
+    // row without one ends the scan.
+    bool rowHadHole = true;
+    for (int row = 0; row < height && rowHadHole; row++) {
+        rowHadHole = false;
+        for (int col = 0; col < width; col++) {
+            int8_t& cell = types[(row * width + col) * BLOCK];
+            if (cell != EMPTY) {
+                continue;
+            }
+            rowHadHole = true;
+            uint64_t allowed = allColors & ~forbiddenColors(board, row, col);
+            if (allowed == 0) {
+                allowed = allColors;
+            }
+            for (int skip = rngs[board].nextInt(popcount64(allowed)); skip > 0; skip--) {
+                allowed &= allowed - 1;
+            }
+            cell = static_cast<int8_t>(lowestBit(allowed));
+        }
+    }
+}
+
+uint64_t BoardBatch::forbiddenColors(int board, int row, int col) const {
+    const int8_t* types = lanes(board / BLOCK, 0) + board % BLOCK;
+    return refillForbiddenColors(row, col, [&](int r, int c) -> int {
+        return r >= 0 && r < height && c >= 0 && c < width ? types[(r * width + c) * BLOCK] : EMPTY;
+    });
+}
+
+int BoardBatch::processCascade() {
+    std::fill(steps.begin(), steps.end(), 0);
+    activateAll();
+    return cascade();
+}
+
+// Boards without matches this step have none the next, so each step only
+// rescans, drops and refills the boards that just matched.
+int BoardBatch::cascade() {
+    const int MAX_CASCADES = 100;
+    int cascadeCount = 0;
+    while (cascadeCount < MAX_CASCADES && scanMatches() > 0) {
+        cascadeCount++;
+        clearMatches();
+        for (int block = 0; block < blockCount; block++) {
+            if (anyMatched[block] == 0) {
+                continue;
+            }
+            dropBlock(block);
+            for (uint64_t word = anyMatched[block]; word; word &= word - 1) {
+                int board = block * BLOCK + lowestBit(word);
+                steps[board]++;
+                refillBoard(board);
+            }
+        }
+        active = anyMatched;
+    }
+    return cascadeCount;
+}
+
+bool BoardBatch::isAdjacentMove(const Move& move) const {
+    auto inBounds = [&](int row, int col) {
+        return row >= 0 && row < height && col >= 0 && col < width;
+    };
+    return inBounds(move.row1, move.col1) && inBounds(move.row2, move.col2) &&
+           abs(move.row1 - move.row2) + abs(move.col1 - move.col2) == 1;
+}
+
+void BoardBatch::swapCells(int board, const Move& move) {
+    int8_t* types = lanes(board / BLOCK, 0) + board % BLOCK;
+    swap(types[(move.row1 * width + move.col1) * BLOCK], types[(move.row2 * width + move.col2) * BLOCK]);
+}
+
+void BoardBatch::applyMoves(const Move* moves, int* results) {
+    std::fill(active.begin(), active.end(), 0);
+    for (int board = 0; board < count; board++) {
+        results[board] = -1;
+        if (moves[board].row1 >= 0 && isAdjacentMove(moves[board])) {
+            swapCells(board, moves[board]);
+            results[board] = 0;
+            active[board / BLOCK] |= bit(board % BLOCK);
+        }
+    }
+
+    // Boards whose swap made no match take it back; the rest cascade.
+    scanMatches();
+    for (int board = 0; board < count; board++) {
+        if (results[board] == 0 && !hasMatches(board)) {
+            swapCells(board, moves[board]);
+            results[board] = -1;
+        }
+    }
+
+    std::fill(steps.begin(), steps.end(), 0);
+    active = anyMatched;
+    cascade();
+    for (int board = 0; board < count; board++) {
+        if (results[board] == 0) {
+            results[board] = steps[board];
+        }
+    }
+}
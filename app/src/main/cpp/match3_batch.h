@@ -0,0 +1,115 @@
+#ifndef MATCH3ENGINE_MATCH3_BATCH_H
+#define MATCH3ENGINE_MATCH3_BATCH_H
+
+#include <cstdint>
+#include <vector>
+#include "match3_engine.h"
+#include "match3_random.h"
+using namespace std;
+
+// Many boards of one size, stepped in lockstep for simulation. Boards are
+// grouped in blocks of 64, and a block is stored structure-of-arrays: for
+// each cell, the item types of its 64 boards side by side. Match detection
+// is then two byte-plane kernel calls per block (horizontal and vertical
+// run starts for every cell and board at once) and gravity is branch-free
+// over 64 lanes. Cascades only revisit blocks that still have a board
+// settling. Board b draws from its own PCG stream (seed, b), so it evolves
+// exactly like a Match3Board<W, H, Colors> seeded the same way.
+class BoardBatch {
+public:
+    static constexpr int8_t EMPTY = -1;
+    static constexpr int BLOCK = 64;
+
+    BoardBatch(int width, int height, int colors, int count, uint64_t seed);
+
+    int size() const {
+        return count;
+    }
+
+    int get(int board, int row, int col) const {
+        return lanes(board / BLOCK, row * width + col)[board % BLOCK];
+    }
+
+    void set(int board, int row, int col, int type) {
+        lanes(board / BLOCK, row * width + col)[board % BLOCK] = static_cast<int8_t>(type);
+    }
+
+    // One board as width * height row-major PackedCells, e.g. for
+    // snapshots. Batches have no specials, so export writes none and import
+    // drops them. Export returns false, writing nothing, if a colour does
+    // not fit in a PackedCell.
+    bool exportPacked(int board, PackedCell* out) const;
+    void importPacked(int board, const PackedCell* in);
+
+    // Random colours, matches allowed, like Match3Board::fill.
+    void fill();
+
+    // Marks every matched cell on every board. Returns the number of boards
+    // with at least one match.
+    int findMatches();
+    bool hasMatches(int board) const;
+    void clearMatches();
+    void applyGravity();
+    void refill();
+
+    // Clear, drop and refill until every board is stable. Returns the most
+    // steps any board took; cascadeSteps(b) has each board's own count.
+    int processCascade();
+    int cascadeSteps(int board) const {
+        return steps[board];
+    }
+
+    // One move per board (row1 < 0 skips that board) on stable boards, i.e.
+    // after processCascade(). A move that is not an adjacent swap, or makes
+    // no match, is undone and reported as -1; otherwise results[b] is the
+    // number of cascade steps it caused.
+    void applyMoves(const Move* moves, int* results);
+
+    Match3Random& random(int board) {
+        return rngs[board];
+    }
+
+private:
+    // The 64 lanes of one cell in one block; lane i is board BLOCK * block + i.
+    int8_t* lanes(int block, int cell) {
+        return &cells[(size_t(block) * cellCount + cell) * BLOCK];
+    }
+
+    const int8_t* lanes(int block, int cell) const {
+        return &cells[(size_t(block) * cellCount + cell) * BLOCK];
+    }
+
+    // Bit i of each per-block word is lane i.
+    uint64_t& matchWord(int block, int cell) {
+        return matched[size_t(block) * cellCount + cell];
+    }
+
+    void activateAll();
+    // findMatches() over the boards in `active` only.
+    int scanMatches();
+    // Clears, drops and refills the boards in `active` until they settle.
+    int cascade();
+    void dropBlock(int block);
+    void refillBoard(int board);
+    bool isAdjacentMove(const Move& move) const;
+    void swapCells(int board, const Move& move);
+    uint64_t forbiddenColors(int board, int row, int col) const;
+
+    int width;
+    int height;
+    int colors;
+    int count;
+    int cellCount;
+    int blockCount;
+    // Lanes past `count` in the last block stay EMPTY.
+    vector<int8_t> cells;
+    vector<uint64_t> matched;
+    vector<uint64_t> anyMatched;
+    vector<uint64_t> active;
+    vector<uint64_t> horizontalStarts;
+    vector<uint64_t> verticalStarts;
+    vector<int> steps;
+    vector<Match3Random> rngs;
+};
+
+#endif //MATCH3ENGINE_MATCH3_BATCH_H
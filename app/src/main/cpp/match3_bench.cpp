@@ -0,0 +1,332 @@
+// Standalone benchmark suite for the engine. Builds on plain Linux (no JNI,
+// no Android glue) and prints one JSON document on stdout:
+//
+//   match3_bench [--quick] [--filter <substring>]
+//
+// Each result reports the median and fastest of several timed samples, in
+// nanoseconds per operation.
+#include "match3_batch.h"
+#include "match3_engine.h"
+#include "match3_search.h"
+#include "match3_simd.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+using namespace std;
+
+struct BoardConfig {
+    int width;
+    int height;
+    int colors;
+};
+
+struct BenchResult {
+    string name;
+    BoardConfig board;
+    long iterations;
+    double medianNs;
+    double minNs;
+};
+
+struct BenchOptions {
+    bool quick = false;
+    string filter;
+};
+
+using Clock = chrono::steady_clock;
+
+static double elapsedNs(Clock::time_point start, Clock::time_point end) {
+    return chrono::duration<double, nano>(end - start).count();
+}
+
+static BenchResult summarize(const string& name, const BoardConfig& board, long iterations, vector<double> samples) {
+    sort(samples.begin(), samples.end());
+    return {name, board, iterations, samples[samples.size() / 2], samples.front()};
+}
+
+// Times `op` in batches: for operations that leave the engine as they found it.
+static BenchResult measureRepeated(const string& name, const BoardConfig& board, const BenchOptions& options,
+                                   const function<void()>& op) {
+    const int samples = options.quick ? 3 : 7;
+    const Clock::time_point budget = Clock::now();
+    long batch = 1;
+    // Grow the batch until one sample takes about a millisecond.
+    while (batch < (1 << 24)) {
+        Clock::time_point start = Clock::now();
+        for (long i = 0; i < batch; i++) {
+            op();
+        }
+        if (elapsedNs(start, Clock::now()) > 1e6 || elapsedNs(budget, Clock::now()) > 2e8) {
+            break;
+        }
+        batch *= 2;
+    }
+
+    vector<double> perOp;
+    for (int sample = 0; sample < samples; sample++) {
+        Clock::time_point start = Clock::now();
+        for (long i = 0; i < batch; i++) {
+            op();
+        }
+        perOp.push_back(elapsedNs(start, Clock::now()) / batch);
+    }
+    return summarize(name, board, batch * samples, perOp);
+}
+
+// Times `op` alone after an untimed `setup`, for operations that change the
+// board (gravity, refill, shuffle, whole moves).
+static BenchResult measureWithSetup(const string& name, const BoardConfig& board, const BenchOptions& options,
+                                    const function<void()>& setup, const function<void()>& op) {
+    const int samples = options.quick ? 3 : 7;
+    const int perSample = options.quick ? 20 : 200;
+    vector<double> perOp;
+    for (int sample = 0; sample < samples; sample++) {
+        double total = 0;
+        for (int i = 0; i < perSample; i++) {
+            setup();
+            Clock::time_point start = Clock::now();
+            op();
+            total += elapsedNs(start, Clock::now());
+        }
+        perOp.push_back(total / perSample);
+    }
+    return summarize(name, board, long(samples) * perSample, perOp);
+}
+
+static vector<vector<Cell>> randomGrid(const BoardConfig& board, Match3Random& rng) {
+    vector<vector<Cell>> grid(board.height, vector<Cell>(board.width));
+    for (auto& row: grid) {
+        for (Cell& cell: row) {
+            cell = Cell(rng.nextInt(board.colors));
+        }
+    }
+    return grid;
+}
+
+// A random board with its matches cleared, i.e. the state gravity and
+// refill see in the middle of a cascade step.
+static vector<vector<Cell>> gridWithHoles(const BoardConfig& board, Match3Random& rng) {
+    vector<vector<Cell>> grid = randomGrid(board, rng);
+    Match3Engine engine(board.width, board.height, board.colors, 1);
+    engine.setGrid(grid);
+    for (const auto& cell: engine.findAllMatches()) {
+        grid[cell.first][cell.second] = Cell();
+    }
+    return grid;
+}
+
+static void runMicro(const BoardConfig& board, const BenchOptions& options, vector<BenchResult>& results) {
+    Match3Random rng(board.width * 1000 + board.height * 10 + board.colors);
+    vector<vector<Cell>> grid = randomGrid(board, rng);
+    vector<vector<Cell>> holes = gridWithHoles(board, rng);
+
+    Match3Engine engine(board.width, board.height, board.colors, 7);
+    engine.setGrid(grid);
+    Match3Engine cold = engine;
+    Match3Engine withHoles = engine;
+    withHoles.setGrid(holes);
+    Match3Engine work = engine;
+
+    auto wanted = [&](const string& name) {
+        return options.filter.empty() || name.find(options.filter) != string::npos;
+    };
+    size_t sink = 0;
+
+    if (wanted("findAllMatches")) {
+        results.push_back(measureRepeated("findAllMatches", board, options, [&]() {
+            sink += engine.findAllMatches().size();
+        }));
+    }
+    if (wanted("findAllMatchesWithPatterns")) {
+        results.push_back(measureRepeated("findAllMatchesWithPatterns", board, options, [&]() {
+            sink += engine.findAllMatchesWithPatterns().size();
+        }));
+    }
+    if (wanted("applyGravity")) {
+        results.push_back(measureWithSetup("applyGravity", board, options,
+                                           [&]() { work = withHoles; },
+                                           [&]() { work.applyGravity(); }));
+    }
+    if (wanted("refillSmart")) {
+        withHoles.applyGravity();
+        results.push_back(measureWithSetup("refillSmart", board, options,
+                                           [&]() { work = withHoles; },
+                                           [&]() { work.refillSmart(); }));
+        withHoles.setGrid(holes);
+    }
+    // "cold" rebuilds the board views and the valid-move index from
+    // scratch, "warm" answers from the index kept up to date by mutators.
+    if (wanted("hasValidMoves")) {
+        results.push_back(measureWithSetup("hasValidMoves/cold", board, options,
+                                           [&]() { work = cold; },
+                                           [&]() { work.boardChanged(); sink += work.hasValidMoves(); }));
+        results.push_back(measureRepeated("hasValidMoves/warm", board, options, [&]() {
+            sink += engine.hasValidMoves();
+        }));
+    }
+    if (wanted("findHint")) {
+        results.push_back(measureWithSetup("findHint/cold", board, options,
+                                           [&]() { work = cold; },
+                                           [&]() { work.boardChanged(); sink += work.findHint().has_value(); }));
+    }
+    if (wanted("shuffle")) {
+        results.push_back(measureWithSetup("shuffle", board, options,
+                                           [&]() { work = cold; },
+                                           [&]() { sink += work.shuffle(); }));
+    }
+    if (sink == size_t(-1)) {
+        fprintf(stderr, "unreachable\n");
+    }
+}
+
+// Whole moves: pick the hinted swap, then swap, cascade with specials and
+// refill through swapAndResolve(), the path one UI move takes.
+static void runMacro(const BoardConfig& board, const BenchOptions& options, vector<BenchResult>& results) {
+    if (!options.filter.empty() && string("move").find(options.filter) == string::npos) {
+        return;
+    }
+    Match3Engine engine(board.width, board.height, board.colors, 11);
+    engine.processCascadeWithSpecials();
+    vector<int32_t> events(1 << 16);
+    optional<Move> move;
+
+    results.push_back(measureWithSetup("move", board, options,
+                                       [&]() {
+                                           move = engine.findHint();
+                                           if (!move && !engine.shuffle()) {
+                                               engine = Match3Engine(board.width, board.height, board.colors, 11);
+                                           }
+                                           move = engine.findHint();
+                                       },
+                                       [&]() {
+                                           if (move) {
+                                               engine.swapAndResolve(move->row1, move->col1, move->row2, move->col2,
+                                                                     events.data(), events.size());
+                                           }
+                                       }));
+}
+
+// Balancing throughput: one random adjacent swap on each of many boards,
+// stepped in lockstep by BoardBatch ("batch_move") or one Match3Engine at a
+// time ("single_move"). Both report nanoseconds per board per move.
+static void runBatch(const BoardConfig& board, const BenchOptions& options, vector<BenchResult>& results) {
+    const int BOARDS = 1024;
+    Match3Random rng(13);
+    vector<Move> moves(BOARDS);
+    auto randomMoves = [&]() {
+        for (Move& move: moves) {
+            bool horizontal = rng.nextInt(2) == 0;
+            move.row1 = rng.nextInt(board.height - (horizontal ? 0 : 1));
+            move.col1 = rng.nextInt(board.width - (horizontal ? 1 : 0));
+            move.row2 = move.row1 + (horizontal ? 0 : 1);
+            move.col2 = move.col1 + (horizontal ? 1 : 0);
+        }
+    };
+    auto perBoard = [&](BenchResult result) {
+        result.medianNs /= BOARDS;
+        result.minNs /= BOARDS;
+        return result;
+    };
+
+    if (options.filter.empty() || string("batch_move").find(options.filter) != string::npos) {
+        BoardBatch batch(board.width, board.height, board.colors, BOARDS, 11);
+        batch.fill();
+        batch.processCascade();
+        vector<int> outcomes(BOARDS);
+        results.push_back(perBoard(measureWithSetup("batch_move", board, options, randomMoves, [&]() {
+            batch.applyMoves(moves.data(), outcomes.data());
+        })));
+    }
+
+    if (options.filter.empty() || string("single_move").find(options.filter) != string::npos) {
+        vector<Match3Engine> engines;
+        for (int index = 0; index < BOARDS; index++) {
+            engines.emplace_back(board.width, board.height, board.colors, index);
+            engines.back().processCascadeWithSpecials();
+        }
+        results.push_back(perBoard(measureWithSetup("single_move", board, options, randomMoves, [&]() {
+            for (int index = 0; index < BOARDS; index++) {
+                engines[index].swap(moves[index].row1, moves[index].col1, moves[index].row2, moves[index].col2);
+            }
+        })));
+    }
+}
+
+// One full best-move search (every valid swap, 16 rollouts each) on a pool
+// with one worker per hardware thread.
+static void runSearch(const BoardConfig& board, const BenchOptions& options, vector<BenchResult>& results) {
+    if (!options.filter.empty() && string("best_move").find(options.filter) == string::npos) {
+        return;
+    }
+    static WorkStealingPool pool;
+    Match3Engine engine(board.width, board.height, board.colors, 11);
+    engine.processCascadeWithSpecials();
+    BestMoveOptions search;
+    search.rollouts = 16;
+    results.push_back(measureWithSetup("best_move", board, options, []() {}, [&]() {
+        findBestMove(engine, pool, search);
+    }));
+}
+
+static const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::SSE2:
+            return "sse2";
+        case SimdLevel::AVX2:
+            return "avx2";
+        case SimdLevel::NEON:
+            return "neon";
+        default:
+            return "scalar";
+    }
+}
+
+static void printJson(const vector<BenchResult>& results) {
+    printf("{\n  \"simd\": \"%s\",\n  \"benchmarks\": [\n", simdLevelName(simdKernels().level));
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& result = results[i];
+        printf("    {\"name\": \"%s\", \"width\": %d, \"height\": %d, \"colors\": %d, "
+               "\"iterations\": %ld, \"median_ns\": %.1f, \"min_ns\": %.1f}%s\n",
+               result.name.c_str(), result.board.width, result.board.height, result.board.colors,
+               result.iterations, result.medianNs, result.minNs, i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            options.quick = true;
+        }
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            options.filter = argv[++i];
+        }
+        else {
+            fprintf(stderr, "usage: %s [--quick] [--filter <substring>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    const BoardConfig microBoards[] = {{8, 8, 5}, {9, 9, 6}, {16, 16, 6}, {128, 128, 6}};
+    const BoardConfig macroBoards[] = {{8, 8, 4}, {8, 8, 6}, {9, 9, 5}, {7, 10, 5}, {16, 16, 6}, {32, 32, 6}};
+    const BoardConfig batchBoards[] = {{8, 8, 5}, {9, 9, 6}};
+
+    vector<BenchResult> results;
+    for (const BoardConfig& board: microBoards) {
+        runMicro(board, options, results);
+    }
+    for (const BoardConfig& board: macroBoards) {
+        runMacro(board, options, results);
+    }
+    for (const BoardConfig& board: batchBoards) {
+        runBatch(board, options, results);
+        runSearch(board, options, results);
+    }
+    printJson(results);
+    return 0;
+}
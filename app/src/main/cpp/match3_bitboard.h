@@ -0,0 +1,166 @@
+#ifndef MATCH3ENGINE_MATCH3_BITBOARD_H
+#define MATCH3ENGINE_MATCH3_BITBOARD_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+// Boards up to this many columns keep one 64-bit word per row and per colour.
+const int BITBOARD_MAX_WIDTH = 64;
+
+inline uint64_t bit(int col) {
+    return uint64_t(1) << col;
+}
+
+inline int popcount64(uint64_t word) {
+    return __builtin_popcountll(word);
+}
+
+inline int lowestBit(uint64_t word) {
+    return __builtin_ctzll(word);
+}
+
+// Every bit that belongs to a horizontal run of 3 or more set bits.
+inline uint64_t horizontalRuns(uint64_t row) {
+    uint64_t starts = row & (row >> 1) & (row >> 2);
+    return starts | (starts << 1) | (starts << 2);
+}
+
+// Every bit of `middle` that is set in the same column of three consecutive
+// rows, for each of the three placements that include `middle`.
+inline uint64_t verticalRuns(uint64_t above2, uint64_t above1, uint64_t middle,
+                             uint64_t below1, uint64_t below2) {
+    return (above2 & above1 & middle) | (above1 & middle & below1) | (middle & below1 & below2);
+}
+
+// Colours (one bit per type, types below 64) that would complete a run of
+// three at (row, col) with its current neighbours: the refill rule shared
+// by Match3Engine, Match3Board and BoardBatch. `typeAt(r, c)` returns the
+// type there, or a negative value for an empty or off-board cell; negative
+// types never match.
+template<typename TypeAt>
+inline uint64_t refillForbiddenColors(int row, int col, TypeAt typeAt) {
+    uint64_t forbidden = 0;
+    auto forbidPair = [&](int first, int second) {
+        if (first == second && static_cast<unsigned>(first) < 64u) {
+            forbidden |= bit(first);
+        }
+    };
+    int left1 = typeAt(row, col - 1);
+    int right1 = typeAt(row, col + 1);
+    int up1 = typeAt(row - 1, col);
+    int down1 = typeAt(row + 1, col);
+    forbidPair(left1, typeAt(row, col - 2));
+    forbidPair(right1, typeAt(row, col + 2));
+    forbidPair(left1, right1);
+    forbidPair(up1, typeAt(row - 2, col));
+    forbidPair(down1, typeAt(row + 2, col));
+    forbidPair(up1, down1);
+    return forbidden;
+}
+
+// A set of board cells stored row by row, 64 columns per word. Boards no
+// wider than BITBOARD_MAX_WIDTH get exactly one word per row.
+struct BoardMask {
+    int width = 0;
+    int height = 0;
+    int wordsPerRow = 0;
+    vector<uint64_t> words;
+
+    BoardMask() = default;
+    BoardMask(int width, int height) {
+        reset(width, height);
+    }
+
+    void reset(int newWidth, int newHeight) {
+        width = newWidth;
+        height = newHeight;
+        wordsPerRow = (newWidth + 63) / 64;
+        words.assign(wordsPerRow * newHeight, 0);
+    }
+
+    void clear() {
+        fill(words.begin(), words.end(), 0);
+    }
+
+    uint64_t& word(int row, int col) {
+        return words[row * wordsPerRow + col / 64];
+    }
+
+    uint64_t word(int row, int col) const {
+        return words[row * wordsPerRow + col / 64];
+    }
+
+    void setAll() {
+        uint64_t lastWord = width % 64 ? bit(width % 64) - 1 : ~uint64_t(0);
+        for (int row = 0; row < height; row++) {
+            for (int index = 0; index < wordsPerRow; index++) {
+                words[row * wordsPerRow + index] = index == wordsPerRow - 1 ? lastWord : ~uint64_t(0);
+            }
+        }
+    }
+
+    bool test(int row, int col) const {
+        return (word(row, col) >> (col % 64)) & 1;
+    }
+
+    void set(int row, int col) {
+        word(row, col) |= bit(col % 64);
+    }
+
+    void unset(int row, int col) {
+        word(row, col) &= ~bit(col % 64);
+    }
+
+    // Sets rows firstRow..lastRow of columns firstCol..lastCol, clipped to
+    // the board, a word at a time.
+    void setRect(int firstRow, int firstCol, int lastRow, int lastCol) {
+        firstRow = max(firstRow, 0);
+        lastRow = min(lastRow, height - 1);
+        firstCol = max(firstCol, 0);
+        lastCol = min(lastCol, width - 1);
+        if (firstCol > lastCol) {
+            return;
+        }
+        for (int index = firstCol / 64; index <= lastCol / 64; index++) {
+            int low = max(firstCol - index * 64, 0);
+            int high = min(lastCol - index * 64, 63);
+            uint64_t span = (high == 63 ? ~uint64_t(0) : bit(high + 1) - 1) & ~(bit(low) - 1);
+            for (int row = firstRow; row <= lastRow; row++) {
+                words[row * wordsPerRow + index] |= span;
+            }
+        }
+    }
+
+    bool empty() const {
+        for (uint64_t w: words) {
+            if (w) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int count() const {
+        int total = 0;
+        for (uint64_t w: words) {
+            total += popcount64(w);
+        }
+        return total;
+    }
+
+    // Visits every set cell in row-major order.
+    template<typename Visitor>
+    void forEach(Visitor visit) const {
+        for (int row = 0; row < height; row++) {
+            for (int index = 0; index < wordsPerRow; index++) {
+                for (uint64_t w = words[row * wordsPerRow + index]; w; w &= w - 1) {
+                    visit(row, index * 64 + lowestBit(w));
+                }
+            }
+        }
+    }
+};
+
+#endif //MATCH3ENGINE_MATCH3_BITBOARD_H
@@ -0,0 +1,282 @@
+#ifndef MATCH3ENGINE_MATCH3_BOARD_H
+#define MATCH3ENGINE_MATCH3_BOARD_H
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <type_traits>
+#include "match3_bitboard.h"
+#include "match3_random.h"
+using namespace std;
+
+// Narrowest unsigned word that holds one row of `Bits` cells.
+template<int Bits>
+using BoardRowWord = conditional_t<Bits <= 8, uint8_t,
+                     conditional_t<Bits <= 16, uint16_t,
+                     conditional_t<Bits <= 32, uint32_t, uint64_t>>>;
+
+// Fixed-size board for the sizes production uses (8x8, 9x9, 7x10, ...).
+// Dimensions and colour count are template parameters, so storage lives
+// inline with no heap, loops have constant trip counts the compiler can
+// unroll, and each bitboard row uses the narrowest word that fits W. The
+// colour rules (swaps, matches, gravity, refill) match Match3Engine; there
+// are no specials, so boards that use them, and other sizes, stay on the
+// engine.
+template<int W, int H, int Colors>
+class Match3Board {
+    static_assert(W >= 1 && W <= BITBOARD_MAX_WIDTH, "one bitboard word per row");
+    static_assert(H >= 1, "board needs at least one row");
+    static_assert(Colors >= 1 && Colors <= 64, "colour sets are 64-bit masks");
+
+public:
+    using Row = BoardRowWord<W>;
+    // One word per row; bit `col` of mask[row] is cell (row, col).
+    using Mask = array<Row, H>;
+
+    static constexpr int WIDTH = W;
+    static constexpr int HEIGHT = H;
+    static constexpr int COLORS = Colors;
+    static constexpr int EMPTY = -1;
+
+    Match3Board() {
+        types.fill(EMPTY);
+        colorRows.fill(0);
+    }
+
+    int get(int row, int col) const {
+        return types[row * W + col];
+    }
+
+    void set(int row, int col, int type) {
+        int8_t& cell = types[row * W + col];
+        if (cell >= 0) {
+            colorRows[cell * H + row] &= static_cast<Row>(~rowBit(col));
+        }
+        if (type >= 0) {
+            colorRows[type * H + row] |= rowBit(col);
+        }
+        cell = static_cast<int8_t>(type);
+    }
+
+    void fill(Match3Random& rng) {
+        for (int row = 0; row < H; row++) {
+            for (int col = 0; col < W; col++) {
+                set(row, col, rng.nextInt(Colors));
+            }
+        }
+    }
+
+    Mask findMatches() const {
+        Mask mask{};
+        for (int type = 0; type < Colors; type++) {
+            const Row* rows = &colorRows[type * H];
+            for (int row = 0; row < H; row++) {
+                uint64_t above2 = row >= 2 ? rows[row - 2] : 0;
+                uint64_t above1 = row >= 1 ? rows[row - 1] : 0;
+                uint64_t below1 = row + 1 < H ? rows[row + 1] : 0;
+                uint64_t below2 = row + 2 < H ? rows[row + 2] : 0;
+                uint64_t runs = verticalRuns(above2, above1, rows[row], below1, below2) | horizontalRuns(rows[row]);
+                mask[row] |= static_cast<Row>(runs);
+            }
+        }
+        return mask;
+    }
+
+    bool hasMatches() const {
+        Mask mask = findMatches();
+        for (Row row: mask) {
+            if (row) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Swaps with the right and lower neighbour that would make a match,
+    // counted on the bitboards: a colour moved into a cell makes a run when
+    // the cells it would line up with (not counting the cell it left) hold
+    // that colour. Swapping two equal cells only "matches" through an
+    // existing run.
+    int countValidMoves() const {
+        const uint64_t fullRow = W == 64 ? ~uint64_t(0) : bit(W) - 1;
+        Mask existing = findMatches();
+        array<uint64_t, H> horizontal{};
+        array<uint64_t, H> vertical{};
+        for (int type = 0; type < Colors; type++) {
+            const Row* rows = &colorRows[type * H];
+            auto at = [&](int row) -> uint64_t {
+                return row >= 0 && row < H ? rows[row] : 0;
+            };
+            // Columns where this colour would complete a run within a row.
+            auto rowRuns = [&](uint64_t word) {
+                return (((word << 1) & (word << 2)) | ((word << 1) & (word >> 1)) | ((word >> 1) & (word >> 2))) & fullRow;
+            };
+            for (int row = 0; row < H; row++) {
+                uint64_t here = rows[row];
+                uint64_t below = at(row + 1);
+                uint64_t leftPair = (here << 1) & (here << 2) & fullRow;
+                uint64_t rightPair = (here >> 1) & (here >> 2);
+                uint64_t upPair = at(row - 1) & at(row - 2);
+                uint64_t columnRuns = upPair | (below & at(row + 2)) | (at(row - 1) & below);
+
+                // Swap (row, c) <-> (row, c + 1), indexed by c.
+                horizontal[row] |= (here >> 1) & (leftPair | columnRuns);
+                horizontal[row] |= here & ((rightPair | columnRuns) >> 1);
+                horizontal[row] |= here & (here >> 1) & (existing[row] | (uint64_t(existing[row]) >> 1));
+
+                // Swap (row, c) <-> (row + 1, c), indexed by the upper row.
+                if (row + 1 < H) {
+                    vertical[row] |= below & (rowRuns(here) | upPair);
+                    vertical[row] |= here & (rowRuns(below) | (at(row + 2) & at(row + 3)));
+                    vertical[row] |= here & below & (existing[row] | existing[row + 1]);
+                }
+            }
+        }
+
+        int count = 0;
+        for (int row = 0; row < H; row++) {
+            count += popcount64(horizontal[row] & (fullRow >> 1));
+            count += popcount64(vertical[row]);
+        }
+        return count;
+    }
+
+    // Adjacent in-bounds cells whose swap would line up a run through
+    // either of them, judged in place like Match3Engine::isValidSwap().
+    bool isValidSwap(int row1, int col1, int row2, int col2) const {
+        if (!inBounds(row1, col1) || !inBounds(row2, col2)) {
+            return false;
+        }
+        if (abs(row1 - row2) + abs(col1 - col2) != 1) {
+            return false;
+        }
+        int type1 = get(row1, col1);
+        int type2 = get(row2, col2);
+        return runThrough(row1, col1, type2, row2, col2, type1) ||
+               runThrough(row2, col2, type1, row1, col1, type2);
+    }
+
+    // Swaps and runs processCascade(). Returns false, with the board
+    // unchanged, for a swap isValidSwap() rejects.
+    bool swap(int row1, int col1, int row2, int col2, Match3Random& rng) {
+        if (!isValidSwap(row1, col1, row2, col2)) {
+            return false;
+        }
+        int type1 = get(row1, col1);
+        set(row1, col1, get(row2, col2));
+        set(row2, col2, type1);
+        processCascade(rng);
+        return true;
+    }
+
+    void clear(const Mask& mask) {
+        for (int row = 0; row < H; row++) {
+            for (uint64_t word = mask[row]; word; word &= word - 1) {
+                set(row, lowestBit(word), EMPTY);
+            }
+        }
+    }
+
+    void applyGravity() {
+        for (int col = 0; col < W; col++) {
+            int writeRow = H - 1;
+            for (int row = H - 1; row >= 0; row--) {
+                int type = get(row, col);
+                if (type == EMPTY) {
+                    continue;
+                }
+                if (row != writeRow) {
+                    set(writeRow, col, type);
+                    set(row, col, EMPTY);
+                }
+                writeRow--;
+            }
+        }
+    }
+
+    // Fills empty cells with colours that do not complete a run, like
+    // Match3Engine's refill.
+    void refill(Match3Random& rng) {
+        const uint64_t allColors = Colors == 64 ? ~uint64_t(0) : bit(Colors) - 1;
+        for (int row = 0; row < H; row++) {
+            for (int col = 0; col < W; col++) {
+                if (get(row, col) != EMPTY) {
+                    continue;
+                }
+                uint64_t allowed = allColors & ~forbiddenColors(row, col);
+                if (allowed == 0) {
+                    allowed = allColors;
+                }
+                for (int skip = rng.nextInt(popcount64(allowed)); skip > 0; skip--) {
+                    allowed &= allowed - 1;
+                }
+                set(row, col, lowestBit(allowed));
+            }
+        }
+    }
+
+    // Clear, drop and refill until the board is stable. Returns the number
+    // of steps.
+    int processCascade(Match3Random& rng) {
+        const int MAX_CASCADES = 100;
+        int cascadeCount = 0;
+        while (cascadeCount < MAX_CASCADES) {
+            Mask mask = findMatches();
+            bool any = false;
+            for (Row row: mask) {
+                any |= row != 0;
+            }
+            if (!any) {
+                break;
+            }
+            cascadeCount++;
+            clear(mask);
+            applyGravity();
+            refill(rng);
+        }
+        return cascadeCount;
+    }
+
+private:
+    static constexpr Row rowBit(int col) {
+        return static_cast<Row>(Row(1) << col);
+    }
+
+    static bool inBounds(int row, int col) {
+        return row >= 0 && row < H && col >= 0 && col < W;
+    }
+
+    // Whether `type` at (row, col), with (otherRow, otherCol) holding
+    // `otherType`, would be part of a run of three. Empty never matches.
+    bool runThrough(int row, int col, int type, int otherRow, int otherCol, int otherType) const {
+        if (type == EMPTY) {
+            return false;
+        }
+        auto sameAt = [&](int r, int c) {
+            if (!inBounds(r, c)) {
+                return false;
+            }
+            return (r == otherRow && c == otherCol ? otherType : get(r, c)) == type;
+        };
+        auto armLength = [&](int rowStep, int colStep) {
+            int length = 0;
+            while (length < 2 && sameAt(row + (length + 1) * rowStep, col + (length + 1) * colStep)) {
+                length++;
+            }
+            return length;
+        };
+        return armLength(0, -1) + armLength(0, 1) >= 2 || armLength(-1, 0) + armLength(1, 0) >= 2;
+    }
+
+    uint64_t forbiddenColors(int row, int col) const {
+        return refillForbiddenColors(row, col, [&](int r, int c) {
+            return inBounds(r, c) ? get(r, c) : EMPTY;
+        });
+    }
+
+    // Row-major types plus, per colour, one bitboard word per row.
+    array<int8_t, W * H> types;
+    array<Row, Colors * H> colorRows;
+};
+
+#endif //MATCH3ENGINE_MATCH3_BOARD_H
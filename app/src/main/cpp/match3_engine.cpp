@@ -2,53 +2,66 @@
 // Created by Nguyễn Tuấn Anh on 15/2/26.
 //
 #include "match3_engine.h"
+#include "match3_simd.h"
+#include "match3_log.h"
+#include "match3_zobrist.h"
+#include <algorithm>
 #include <random>
-#include <iostream>
-#define LOG_TAG "Match3Engine"
-#ifdef __ANDROID__
-#include <android/log.h>
-    #define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
-#else
-#include <iostream>
-#define LOGD(...) printf(__VA_ARGS__); printf("\n")
-#endif
 
 Match3Engine::Match3Engine(int width, int height, int itemTypes):
-    width(width), height(height), itemTypes(itemTypes) {
-    grid.resize(height, vector<Cell>(width));
+    Match3Engine(width, height, itemTypes, random_device{}()) {
+}
 
-    random_device rd;
-    mt19937 gen(rd());
-    uniform_int_distribution<> dis(0, itemTypes - 1);
+Match3Engine::Match3Engine(int width, int height, int itemTypes, uint64_t seed):
+    width(width), height(height), itemTypes(itemTypes), rng(seed) {
+    MutationScope scope(*this);
+    resetStats();
+    cells.resize(width * height);
 
     for (int row = 0; row < height; row++) {
         for (int col = 0; col < width; col++) {
-            grid[row][col].type = dis(gen);
-            grid[row][col].specialType = SpecialType::NONE;
+            cellAt(row, col) = Cell(rng.nextInt(itemTypes));
         }
     }
+    rebuildBoardViews();
+}
+
+void Match3Engine::setSeed(uint64_t seed, uint64_t stream) {
+    rng.setSeed(seed, stream);
+}
+
+RandomState Match3Engine::getRandomState() const {
+    return rng.getState();
+}
+
+void Match3Engine::setRandomState(const RandomState& state) {
+    rng.setState(state);
 }
 
-int Match3Engine::getItem(int col, int row) {
+int Match3Engine::getItem(int col, int row) const {
     if (!isInBounds(row, col)) {
         return -1;
     }
-    return grid[row][col].type;
+    return cellAt(row, col).type;
+}
+
+uint64_t Match3Engine::getBoardHash() const {
+    return boardHash;
 }
 
-SpecialType Match3Engine::getSpecialType(int row, int col) {
+SpecialType Match3Engine::getSpecialType(int row, int col) const {
     if (!isInBounds(row, col)) {
         return SpecialType::NONE;
     }
-    return grid[row][col].specialType;
+    return cellAt(row, col).specialType;
 }
 
-int Match3Engine::countConsecutive(int row, int col, int dRow, int dCol, int itemType) {
+int Match3Engine::countConsecutive(int row, int col, int dRow, int dCol, int itemType) const {
     int count = 0;
     int nRow = row + dRow;
     int nCol = col + dCol;
 
-    while (isInBounds(nRow, nCol) && grid[nRow][nCol].type == itemType) {
+    while (isInBounds(nRow, nCol) && cellAt(nRow, nCol).type == itemType) {
         count++;
         nRow += dRow;
         nCol += dCol;
@@ -57,12 +70,91 @@ int Match3Engine::countConsecutive(int row, int col, int dRow, int dCol, int ite
     return count;
 }
 
-MatchResult Match3Engine::detectPatternAt(int row, int col) {
+// Pattern classification is a lookup: the four arm lengths around a cell,
+// clamped to 0..MAX_ARM, index a table built at compile time. Arms longer
+// than MAX_ARM classify the same, since one arm of four already makes five
+// in a line. New shapes only need a change to classifyArms().
+static constexpr int MAX_ARM = 4;
+static constexpr int ARM_VALUES = MAX_ARM + 1;
+static constexpr uint8_t HORIZONTAL_SPAN = 1;
+static constexpr uint8_t VERTICAL_SPAN = 2;
+
+struct PatternEntry {
+    MatchPattern pattern = MatchPattern::NONE;
+    SpecialType special = SpecialType::NONE;
+    // Which runs through the cell the match covers: every one of length 3+.
+    uint8_t spans = 0;
+};
+
+// Priority: five in a line, then T, then L, then four in a line, then three.
+static constexpr PatternEntry classifyArms(int left, int right, int up, int down) {
+    int horizontal = left + 1 + right;
+    int vertical = up + 1 + down;
+    PatternEntry entry;
+    entry.spans = (horizontal >= 3 ? HORIZONTAL_SPAN : 0) | (vertical >= 3 ? VERTICAL_SPAN : 0);
+
+    bool isT = (left >= 1 && right >= 1 && (up >= 2 || down >= 2)) ||
+               (up >= 1 && down >= 1 && (left >= 2 || right >= 2));
+    bool isL = (left >= 2 || right >= 2) && (up >= 2 || down >= 2);
+    if (horizontal >= 5 || vertical >= 5) {
+        entry.pattern = MatchPattern::MATCH_5;
+        entry.special = SpecialType::COLOR_BOMB;
+    }
+    else if (isT || isL) {
+        entry.pattern = isT ? MatchPattern::MATCH_T : MatchPattern::MATCH_L;
+        entry.special = SpecialType::WRAPPED;
+    }
+    else if (horizontal == 4) {
+        entry.pattern = MatchPattern::MATCH_4_HORIZONTAL;
+        entry.special = SpecialType::STRIPED_HORIZONTAL;
+    }
+    else if (vertical == 4) {
+        entry.pattern = MatchPattern::MATCH_4_VERTICAL;
+        entry.special = SpecialType::STRIPED_VERTICAL;
+    }
+    else if (horizontal >= 3 || vertical >= 3) {
+        entry.pattern = MatchPattern::MATCH_3;
+    }
+    return entry;
+}
+
+static constexpr int armIndex(int left, int right, int up, int down) {
+    return ((min(left, MAX_ARM) * ARM_VALUES + min(right, MAX_ARM)) * ARM_VALUES + min(up, MAX_ARM)) * ARM_VALUES +
+           min(down, MAX_ARM);
+}
+
+struct PatternTable {
+    PatternEntry entries[ARM_VALUES * ARM_VALUES * ARM_VALUES * ARM_VALUES];
+};
+
+static constexpr PatternTable buildPatternTable() {
+    PatternTable table;
+    for (int left = 0; left <= MAX_ARM; left++) {
+        for (int right = 0; right <= MAX_ARM; right++) {
+            for (int up = 0; up <= MAX_ARM; up++) {
+                for (int down = 0; down <= MAX_ARM; down++) {
+                    table.entries[armIndex(left, right, up, down)] = classifyArms(left, right, up, down);
+                }
+            }
+        }
+    }
+    return table;
+}
+
+static constexpr PatternTable PATTERN_TABLE = buildPatternTable();
+
+static_assert(PATTERN_TABLE.entries[armIndex(0, 0, 1, 1)].spans == VERTICAL_SPAN, "vertical three spans its column");
+static_assert(PATTERN_TABLE.entries[armIndex(2, 0, 0, 2)].pattern == MatchPattern::MATCH_L, "corner is an L");
+static_assert(PATTERN_TABLE.entries[armIndex(1, 1, 0, 2)].pattern == MatchPattern::MATCH_T, "stem under a bar is a T");
+static_assert(PATTERN_TABLE.entries[armIndex(0, 0, 7, 0)].special == SpecialType::COLOR_BOMB, "long arms clamp");
+
+MatchResult Match3Engine::detectPatternAt(int row, int col) const {
     MatchResult result;
     result.pattern = MatchPattern::NONE;
+    result.specialType = SpecialType::NONE;
     result.epicenter = {-1, -1};
 
-    int itemType = grid[row][col].type;
+    int itemType = cellAt(row, col).type;
     if (itemType == EMPTY_CELL) {
         return result;
     }
@@ -72,600 +164,1249 @@ MatchResult Match3Engine::detectPatternAt(int row, int col) {
     int up = countConsecutive(row, col, -1, 0, itemType);
     int down = countConsecutive(row, col, 1, 0, itemType);
 
-    int horizontal = left + 1 + right;
-    int vertical = up + 1 + down;
-
-    result.pattern = analyzeMatchPattern(row, col, left, right, up, down);
+    const PatternEntry& entry = PATTERN_TABLE.entries[armIndex(left, right, up, down)];
+    result.pattern = entry.pattern;
+    result.specialType = entry.special;
     result.itemType = itemType;
     result.epicenter = {row, col};
+    if (entry.spans & HORIZONTAL_SPAN) {
+        result.cells.setHorizontal(row, col - left, col + right);
+    }
+    if (entry.spans & VERTICAL_SPAN) {
+        result.cells.setVertical(col, row - up, row + down);
+    }
 
-    switch (result.pattern) {
-        case MatchPattern::MATCH_5:
-        case MatchPattern::MATCH_4_HORIZONTAL:
-        case MatchPattern::MATCH_3:
-            if (horizontal >= 3) {
-                for (int i = col - left; i <= col + right; i++) {
-                    result.cells.insert({row, i});
-                }
+    return result;
+}
+
+MatchPattern Match3Engine::analyzeMatchPattern(int left, int right, int up, int down) const {
+    return PATTERN_TABLE.entries[armIndex(left, right, up, down)].pattern;
+}
+
+void Match3Engine::spawnSpecialCell(const MatchResult &match) {
+    MutationScope scope(*this);
+    MATCH3_TIME_PHASE(StatPhase::SPECIALS);
+    if (match.pattern == MatchPattern::NONE || match.pattern == MatchPattern::MATCH_3) {
+        return;
+    }
+
+    int erow = match.epicenter.first;
+    int ecol = match.epicenter.second;
+
+    if (!isInBounds(erow, ecol)) {
+        return;
+    }
+    Cell special(match.itemType);
+    special.specialType = match.specialType;
+    setCell(erow, ecol, special);
+
+    if (events) {
+        events->push(EventType::SPECIAL);
+        events->push(erow);
+        events->push(ecol);
+        events->push(special.type);
+        events->push(static_cast<int32_t>(match.specialType));
+    }
+}
+
+vector<MatchResult> Match3Engine::findAllMatchesWithPatterns() const {
+    vector<MatchResult> allMatches;
+    BoardMask processedCells;
+    collectPatterns(findMatchMask(), processedCells, allMatches);
+    return allMatches;
+}
+
+// Cascade-internal form: detects into the engine's scratch, so the result
+// is only valid until the next call.
+const vector<MatchResult>& Match3Engine::collectPatternMatches(const BoardMask* dirty) {
+    findMatchMask(matchScratch, dirty);
+    MATCH3_TIME_PHASE(StatPhase::PATTERNS);
+    collectPatterns(matchScratch, processedScratch, patternScratch);
+    return patternScratch;
+}
+
+void Match3Engine::collectPatterns(const BoardMask& matches, BoardMask& processed, vector<MatchResult>& out) const {
+    out.clear();
+    processed.reset(width, height);
+
+    // Only cells inside a run can start a pattern, so walk the match mask
+    // (row-major, like a full scan) instead of every cell on the board.
+    matches.forEach([&](int row, int col) {
+        if (processed.test(row, col)) {
+            return;
+        }
+        MatchResult match = detectPatternAt(row, col);
+        if (match.pattern != MatchPattern::NONE) {
+            for (const auto& cell: match.cells) {
+                processed.set(cell.first, cell.second);
             }
-            break;
+            out.push_back(match);
+        }
+    });
+}
+
+[[maybe_unused]] static const char* patternName(MatchPattern pattern) {
+    switch (pattern) {
+        case MatchPattern::MATCH_3:
+            return "3";
         case MatchPattern::MATCH_4_VERTICAL:
-            if (vertical >= 3) {
-                for (int i = row - up; i <= row + down; i++) {
-                    result.cells.insert({i, col});
-                }
-            }
-            break;
-        case MatchPattern::MATCH_L:
+            return "4 (V)";
+        case MatchPattern::MATCH_4_HORIZONTAL:
+            return "4 (H)";
+        case MatchPattern::MATCH_5:
+            return "5";
         case MatchPattern::MATCH_T:
-            for (int i = col - left; i <= col + right; i++) {
-                result.cells.insert({row, i});
-            }
-            for (int i = row - up; i <= row + down; i++) {
-                result.cells.insert({i, col});
-            }
-            break;
+            return "T";
+        case MatchPattern::MATCH_L:
+            return "L";
         default:
-            break;
+            return "none";
     }
+}
 
-    return result;
+int Match3Engine::processCascadeWithSpecials() {
+    MutationScope scope(*this);
+    int cascadeCount = cascadeWithSpecials(0, true);
+    MATCH3_RECORD_CASCADE(cascadeCount);
+    return cascadeCount;
 }
 
-MatchPattern Match3Engine::analyzeMatchPattern(int row, int col, int left, int right, int up,int down) {
-    int horizontal = left + 1 + right;
-    int vertical = up + 1 + down;
+// Steps after the `steps` already taken, until the board is stable. Only
+// rows and columns written by the previous step's removals, gravity and
+// refill can hold a new match, so detection only looks there. The first
+// pass scans the whole board if `fullScan`, and otherwise starts from the
+// cells written so far (e.g. the two cells of a swap on a stable board).
+int Match3Engine::cascadeWithSpecials(int steps, bool fullScan) {
+    int cascadeCount = steps;
 
-    //Priority:
-    //First: Match 5
-    if (horizontal >= 5 || vertical >= 5) {
-        return MatchPattern::MATCH_5;
-    }
-    //Second: Match T, L
-    if (horizontal >= 3 && vertical >= 3) {
-        if (isTPattern(row, col, left, right, up, down)) {
-            return MatchPattern::MATCH_T;
+    while (cascadeCount < MAX_CASCADES) {
+        const auto& matches = collectPatternMatches(cascadeCount == steps && fullScan ? nullptr : &cascadeDirty);
+        if (matches.empty()) {
+            break;
         }
-        if (isLPattern(row, col, left, right, up, down)) {
-            return MatchPattern::MATCH_L;
+        cascadeCount++;
+        cascadeDirty.clear();
+
+        // Every matched cell goes, except where a new special spawns, and
+        // so does everything the specials caught in the matches blow up.
+        bool spawn = maxSpawnSteps <= 0 || cascadeCount <= maxSpawnSteps;
+        clearScratch.reset(width, height);
+        keepScratch.reset(width, height);
+        for (const auto& match: matches) {
+            MATCH3_LOGD("MATCH - %s", patternName(match.pattern));
+            for (const auto& cell: match.cells) {
+                clearScratch.set(cell.first, cell.second);
+            }
+            if (spawn && match.specialType != SpecialType::NONE) {
+                keepScratch.set(match.epicenter.first, match.epicenter.second);
+            }
         }
-    }
-    //Third: Match 4
-    if (horizontal == 4) {
-        return MatchPattern::MATCH_4_HORIZONTAL;
-    }
-    if (vertical == 4) {
-        return MatchPattern::MATCH_4_VERTICAL;
-    }
-    //Forth: Match 3
-    if (horizontal >= 3 || vertical >= 3) {
-        return MatchPattern::MATCH_3;
+        logMatched(cascadeCount, clearScratch);
+        firedScratch.reset(width, height);
+        queueSpecials(clearScratch, nullptr);
+        detonateSpecials(clearScratch, keepScratch);
+        clearRegion(clearScratch, keepScratch);
+
+        if (spawn) {
+            for (const auto& match: matches) {
+                spawnSpecialCell(match);
+            }
+        }
+
+        applyGravity();
+        refillSmart();
     }
 
-    return MatchPattern::NONE;
+    if (cascadeCount == MAX_CASCADES) {
+        cascadeCount = settleMatches(cascadeCount);
+    }
+    return cascadeCount;
 }
 
-bool Match3Engine::isLPattern(int row, int col, int left, int right, int up, int down) {
-    if (left >= 2 && down >= 2) {
-        return true;
-    }
-    if (right >= 2 && down >= 2) {
-        return true;
-    }
-    if (left >= 2 && up >= 2) {
-        return true;
-    }
-    if (right >= 2 && up >= 2) {
-        return true;
+// Ends a cascade cut off at MAX_CASCADES: the whole board is scanned and
+// the matched cells are cleared, without firing or spawning specials, and
+// redrawn in place, until no match is left. Each pass is one more step.
+// Redraws avoid runs, so this takes one pass unless a cell had no safe
+// colour; the pass limit only matters for one- or two-colour boards.
+int Match3Engine::settleMatches(int steps) {
+    for (int pass = 0; pass < MAX_CASCADES; pass++) {
+        findMatchMask(clearScratch, pass == 0 ? nullptr : &cascadeDirty);
+        if (clearScratch.empty()) {
+            break;
+        }
+        steps++;
+        cascadeDirty.clear();
+        logMatched(steps, clearScratch);
+        keepScratch.reset(width, height);
+        clearRegion(clearScratch, keepScratch);
+        refillSmart();
     }
-    return false;
+    return steps;
 }
 
-bool Match3Engine::isTPattern(int row, int col, int left, int right, int up, int down) {
-    if (left >= 1 && right >= 1 && up >= 2) {
-        return true;
-    }
-    if (left >= 1 && right >= 1 && down >= 2) {
-        return true;
+// STEP and MATCHED for one step. Matches that cross (Ls, Ts) share cells,
+// so the cells come from the merged mask, each once, in row-major order.
+void Match3Engine::logMatched(int step, const BoardMask& cells) {
+    if (!events) {
+        return;
     }
-    if (up >= 1 && down >= 1 && left >= 2) {
-        return true;
+    events->push(EventType::STEP);
+    events->push(step);
+    events->push(EventType::MATCHED);
+    events->push(cells.count());
+    cells.forEach([&](int row, int col) {
+        events->push(row);
+        events->push(col);
+    });
+}
+
+// Adds the specials in `cells` that have not fired yet to the activation
+// queue, skipping cells in `keep`.
+void Match3Engine::queueSpecials(const BoardMask& cells, const BoardMask* keep) {
+    for (size_t index = 0; index < cells.words.size(); index++) {
+        uint64_t found = cells.words[index] & specialCells.words[index] & ~firedScratch.words[index];
+        if (keep) {
+            found &= ~keep->words[index];
+        }
+        firedScratch.words[index] |= found;
+        int row = static_cast<int>(index) / cells.wordsPerRow;
+        int colBase = static_cast<int>(index) % cells.wordsPerRow * 64;
+        for (; found; found &= found - 1) {
+            activationQueue.push_back({row, colBase + lowestBit(found)});
+        }
     }
-    if (up >= 1 && down >= 1 && right >= 2) {
-        return true;
+}
+
+// Fires the queued specials in order. Each blast is OR-ed into `region`
+// (cells in `keep` excepted), and the specials it newly reaches join the
+// queue, so a whole chain resolves in one pass without rescanning the
+// board per detonation. The cells are only cleared afterwards, so every
+// special fires with the board as the step found it.
+void Match3Engine::detonateSpecials(BoardMask& region, const BoardMask& keep) {
+    MATCH3_TIME_PHASE(StatPhase::SPECIALS);
+    for (size_t next = 0; next < activationQueue.size(); next++) {
+        int row = activationQueue[next].first;
+        int col = activationQueue[next].second;
+        const Cell& special = cellAt(row, col);
+        blastScratch.reset(width, height);
+        addBlast(blastScratch, row, col, special);
+        for (size_t index = 0; index < region.words.size(); index++) {
+            uint64_t added = blastScratch.words[index] & ~region.words[index] & ~keep.words[index];
+            blastScratch.words[index] = added;
+            region.words[index] |= added;
+        }
+        logActivation(row, col, special.specialType, blastScratch);
+        queueSpecials(blastScratch, &keep);
     }
-    return false;
+    activationQueue.clear();
 }
 
-void Match3Engine::spawnSpecialCell(const MatchResult &match) {
-    if (match.pattern == MatchPattern::NONE || match.pattern == MatchPattern::MATCH_3) {
+void Match3Engine::logActivation(int row, int col, SpecialType special, const BoardMask& cells) {
+    if (!events) {
         return;
     }
+    events->push(EventType::ACTIVATED);
+    events->push(row);
+    events->push(col);
+    events->push(static_cast<int32_t>(special));
+    events->push(cells.count());
+    cells.forEach([&](int cellRow, int cellCol) {
+        events->push(cellRow);
+        events->push(cellCol);
+    });
+}
 
-    int erow = match.epicenter.first;
-    int ecol = match.epicenter.second;
+void Match3Engine::clearRegion(BoardMask& region, const BoardMask& keep) {
+    for (size_t index = 0; index < region.words.size(); index++) {
+        region.words[index] &= ~keep.words[index];
+    }
+    region.forEach([&](int row, int col) {
+        setCell(row, col, Cell());
+    });
+}
 
-    if (!isInBounds(erow, ecol)) {
+// The colour bitboard on narrow boards, the type plane on wide ones.
+void Match3Engine::addColorCells(BoardMask& mask, int type) const {
+    if (type < 0) {
         return;
     }
-    SpecialType specialType = SpecialType::NONE;
-    switch (match.pattern) {
-        case MatchPattern::MATCH_4_HORIZONTAL:
-            specialType = SpecialType::STRIPED_HORIZONTAL;
+    if (useBitboards) {
+        if (type < bitboardColors) {
+            for (int row = 0; row < height; row++) {
+                mask.words[row] |= colorRows[type * height + row];
+            }
+        }
+        return;
+    }
+    for (int index = 0; index < width * height; index++) {
+        if (typePlane[index] == type) {
+            mask.set(index / width, index % width);
+        }
+    }
+}
+
+void Match3Engine::addBlast(BoardMask& blast, int row, int col, const Cell& cell) const {
+    switch (cell.specialType) {
+        case SpecialType::STRIPED_HORIZONTAL:
+            blast.setRect(row, 0, row, width - 1);
             break;
-        case MatchPattern::MATCH_4_VERTICAL:
-            specialType = SpecialType::STRIPED_VERTICAL;
+        case SpecialType::STRIPED_VERTICAL:
+            blast.setRect(0, col, height - 1, col);
             break;
-        case MatchPattern::MATCH_5:
-            specialType = SpecialType::COLOR_BOMB;
+        case SpecialType::WRAPPED:
+            blast.setRect(row - 1, col - 1, row + 1, col + 1);
             break;
-        case MatchPattern::MATCH_L:
-        case MatchPattern::MATCH_T:
-            specialType = SpecialType::WRAPPED;
+        case SpecialType::COLOR_BOMB:
+            addColorCells(blast, cell.type);
             break;
         default:
+            blast.set(row, col);
             break;
     }
-    grid[erow][ecol].type = match.itemType;
-    grid[erow][ecol].specialType = specialType;
 }
 
-vector<MatchResult> Match3Engine::findAllMatchesWithPatterns() {
-    vector<MatchResult> allMatches;
-    set<pair<int, int>> processedCells;
+static bool isStriped(SpecialType special) {
+    return special == SpecialType::STRIPED_HORIZONTAL || special == SpecialType::STRIPED_VERTICAL;
+}
 
-    for (int row = 0; row < height; row++) {
-        for (int col = 0; col < width; col++) {
-            if (processedCells.count({row, col})) {
-                continue;
-            }
-            MatchResult match = detectPatternAt(row, col);
-            if (match.pattern != MatchPattern::NONE) {
-                allMatches.push_back(match);
+// Blast of a special swap centred on (row, col), where `moved` landed and
+// `other` left from.
+void Match3Engine::addSwapBlast(BoardMask& blast, int row, int col, const Cell& moved, const Cell& other) {
+    SpecialType first = moved.specialType;
+    SpecialType second = other.specialType;
+    if (first == SpecialType::COLOR_BOMB && second == SpecialType::COLOR_BOMB) {
+        blast.setRect(0, 0, height - 1, width - 1);
+        return;
+    }
+    if (first == SpecialType::COLOR_BOMB || second == SpecialType::COLOR_BOMB) {
+        // Every cell of the partner's colour fires as the partner would.
+        const Cell& partner = first == SpecialType::COLOR_BOMB ? other : moved;
+        BoardMask& colorCells = blastScratch;
+        colorCells.reset(width, height);
+        addColorCells(colorCells, partner.type);
+        colorCells.forEach([&](int cellRow, int cellCol) {
+            addBlast(blast, cellRow, cellCol, partner);
+        });
+        return;
+    }
+    if (isStriped(first) && isStriped(second)) {
+        blast.setRect(row, 0, row, width - 1);
+        blast.setRect(0, col, height - 1, col);
+    }
+    else if (isStriped(first) || isStriped(second)) {
+        blast.setRect(row - 1, 0, row + 1, width - 1);
+        blast.setRect(0, col - 1, height - 1, col + 1);
+    }
+    else {
+        blast.setRect(row - 2, col - 2, row + 2, col + 2);
+    }
+}
 
-                for (const auto& cell: match.cells) {
-                    processedCells.insert(cell);
-                }
-            }
-        }
+// The special-swap step: both specials fire together as one combination,
+// then the chain and the usual cascade follow. Returns the total steps.
+int Match3Engine::resolveSpecialSwap(int row1, int col1, int row2, int col2) {
+    Cell moved = cellAt(row1, col1);
+    Cell other = cellAt(row2, col2);
+    swapCells(row1, col1, row2, col2);
+    cascadeDirty.clear();
+    if (events) {
+        events->push(EventType::STEP);
+        events->push(1);
     }
 
-    return allMatches;
+    clearScratch.reset(width, height);
+    keepScratch.reset(width, height);
+    firedScratch.reset(width, height);
+    addSwapBlast(clearScratch, row2, col2, moved, other);
+    clearScratch.set(row1, col1);
+    clearScratch.set(row2, col2);
+    firedScratch.set(row1, col1);
+    firedScratch.set(row2, col2);
+    logActivation(row2, col2, moved.specialType != SpecialType::NONE ? moved.specialType : other.specialType,
+                  clearScratch);
+    queueSpecials(clearScratch, nullptr);
+    detonateSpecials(clearScratch, keepScratch);
+    clearRegion(clearScratch, keepScratch);
+    applyGravity();
+    refillSmart();
+
+    int steps = cascadeWithSpecials(1, false);
+    MATCH3_RECORD_CASCADE(steps);
+    return steps;
 }
 
-int Match3Engine::processCascadeWithSpecials() {
-    int cascadeCount = 0;
-    const int MAX_CASCADES = 100;
+// An attached board is kept only for the same width and height: the same
+// cell count in another shape would be read back as the old shape.
+void Match3Engine::resizeBoard(int newWidth, int newHeight) {
+    if (newWidth != width || newHeight != height) {
+        cells.release();
+    }
+    width = newWidth;
+    height = newHeight;
+    cells.resize(size_t(width) * height);
+}
 
-    while (cascadeCount < MAX_CASCADES) {
-        auto matches = findAllMatchesWithPatterns();
-        if (matches.empty()) {
-            break;
-        }
-        cascadeCount++;
+void Match3Engine::setGrid(const vector<vector<Cell>>& grid)  {
+    MutationScope scope(*this);
+    int rows = grid.size();
+    resizeBoard(rows > 0 ? grid[0].size() : 0, rows);
 
-        for (const auto& match: matches) {
-            switch (match.pattern) {
-                case MatchPattern::MATCH_3:
-                    LOGD("MATCH - 3");
-                    break;
-                case MatchPattern::MATCH_4_VERTICAL:
-                    LOGD("MATCH - 4 (V)");
-                    break;
-                case MatchPattern::MATCH_4_HORIZONTAL:
-                    LOGD("MATCH - 4 (H)");
-                    break;
-                case MatchPattern::MATCH_5:
-                    LOGD("MATCH - 5");
-                    break;
-                case MatchPattern::MATCH_T:
-                    LOGD("MATCH - T");
-                    break;
-                case MatchPattern::MATCH_L:
-                    LOGD("MATCH - L");
-                    break;
-                default:
-                    break;
-            }
-
-            for (const auto& cell: match.cells) {
-                if (cell.first != match.epicenter.first || cell.second != match.epicenter.second) {
-                    grid[cell.first][cell.second].type = EMPTY_CELL;
-                    grid[cell.first][cell.second].specialType = SpecialType::NONE;
-                }
-            }
+    for (int row = 0; row < height; row++) {
+        copy(grid[row].begin(), grid[row].end(), cells.begin() + row * width);
+    }
+    rebuildBoardViews();
+}
 
-            spawnSpecialCell(match);
+bool Match3Engine::exportPacked(PackedCell* out, int capacity) const {
+    if (out == nullptr || capacity < width * height) {
+        return false;
+    }
+    for (const Cell& cell: cells) {
+        PackedCell ignored;
+        if (!PackedCell::pack(cell, ignored)) {
+            return false;
+        }
+    }
+    for (size_t index = 0; index < cells.size(); index++) {
+        PackedCell::pack(cells[index], out[index]);
+    }
+    return true;
+}
 
-            if (match.pattern == MatchPattern::MATCH_3) {
-                grid[match.epicenter.first][match.epicenter.second].type = EMPTY_CELL;
-            }
+bool Match3Engine::importPacked(const PackedCell* board, int width, int height) {
+    if (board == nullptr || width <= 0 || height <= 0) {
+        return false;
+    }
+    for (int index = 0; index < width * height; index++) {
+        if (!board[index].hasKnownSpecial()) {
+            return false;
         }
+    }
+    MutationScope scope(*this);
+    resizeBoard(width, height);
+    for (size_t index = 0; index < cells.size(); index++) {
+        cells[index] = board[index].unpack();
+    }
+    rebuildBoardViews();
+    return true;
+}
 
-        applyGravity();
-        refillSmart();
+bool Match3Engine::attachBoard(Cell* board, int width, int height) {
+    if (board == nullptr || width <= 0 || height <= 0) {
+        return false;
     }
+    MutationScope scope(*this);
+    this->width = width;
+    this->height = height;
+    cells.attach(board, size_t(width) * height);
+    rebuildBoardViews();
+    return true;
+}
 
-    return cascadeCount;
+void Match3Engine::detachBoard() {
+    cells.detach();
 }
 
-void Match3Engine::setGrid(vector<vector<Cell>> grid)  {
-    this->grid = grid;
+bool Match3Engine::isBoardAttached() const {
+    return cells.isExternal();
 }
 
-set<pair<int, int>> Match3Engine::findHorizontalMatches(int row) {
-    set<pair<int, int>> matches;
+void Match3Engine::boardChanged() {
+    MutationScope scope(*this);
+    rebuildBoardViews();
+}
 
-    if (width < 3) {
-        return matches;
-    }
+// Both writers emit (row, col) pairs in row-major order and keep counting
+// past `capacity`, so callers can tell when their buffer was too small.
+static int writeCellPairs(const BoardMask& mask, int32_t* out, int capacity) {
+    int count = 0;
+    mask.forEach([&](int row, int col) {
+        if (count < capacity) {
+            out[2 * count] = row;
+            out[2 * count + 1] = col;
+        }
+        count++;
+    });
+    return count;
+}
+
+int Match3Engine::writeMatches(int32_t* out, int capacity) const {
+    return writeCellPairs(findMatchMask(), out, capacity);
+}
 
-    int currentType = grid[row][0].type;
-    int matchStart = 0;
-    int matchLength = 1;
+int Match3Engine::writeChangedCells(int32_t* out, int capacity) {
+    int count = writeCellPairs(changedCells, out, capacity);
+    changedCells.clear();
+    return count;
+}
+
+static uint64_t cellKey(int index, const Cell& cell) {
+    return zobristKey(index, cell.type, static_cast<int>(cell.specialType));
+}
 
-    for (int col = 1; col < width; ++col) {
-        if (grid[row][col].type == currentType && currentType != EMPTY_CELL) {
-            matchLength++;
+void Match3Engine::setCell(int row, int col, const Cell& cell) {
+    Cell& target = cellAt(row, col);
+    int index = row * width + col;
+    boardHash ^= cellKey(index, target) ^ cellKey(index, cell);
+    if (useBitboards) {
+        if (target.type >= 0) {
+            colorRows[target.type * height + row] &= ~bit(col);
         }
-        else {
-            if (matchLength >= 3) {
-                for (int col = matchStart; col < matchStart + matchLength; ++col) {
-                    matches.insert({row, col});
-                }
+        if (cell.type >= 0) {
+            if (cell.type >= bitboardColors) {
+                bitboardColors = cell.type + 1;
+                colorRows.resize(bitboardColors * height, 0);
             }
+            colorRows[cell.type * height + row] |= bit(col);
+        }
+    }
+    else {
+        typePlane[row * width + col] = static_cast<int8_t>(cell.type);
+    }
+    if (cell.specialType != SpecialType::NONE) {
+        specialCells.set(row, col);
+    }
+    else {
+        specialCells.unset(row, col);
+    }
+    moveDirty.set(row, col);
+    cascadeDirty.set(row, col);
+    changedCells.set(row, col);
+    target = cell;
+}
+
+void Match3Engine::swapCells(int row1, int col1, int row2, int col2) {
+    Cell first = cellAt(row1, col1);
+    setCell(row1, col1, cellAt(row2, col2));
+    setCell(row2, col2, first);
+}
 
-            currentType = grid[row][col].type;
-            matchStart = col;
-            matchLength = 1;
+void Match3Engine::rebuildBoardViews() {
+    moveDirty.reset(width, height);
+    moveIndexStale = true;
+    cascadeDirty.reset(width, height);
+    changedCells.reset(width, height);
+    changedCells.setAll();
+    fallDistances.assign(cells.size(), 0);
+    specialCells.reset(width, height);
+    for (size_t index = 0; index < cells.size(); index++) {
+        if (cells[index].specialType != SpecialType::NONE) {
+            specialCells.set(static_cast<int>(index) / width, static_cast<int>(index) % width);
         }
     }
 
-    if (matchLength >= 3) {
-        for (int col = matchStart; col < matchStart + matchLength; ++col) {
-            matches.insert({row, col});
+    useBitboards = width <= BITBOARD_MAX_WIDTH;
+    bitboardColors = itemTypes;
+    boardHash = 0;
+    for (size_t index = 0; index < cells.size(); index++) {
+        bitboardColors = max(bitboardColors, cells[index].type + 1);
+        boardHash ^= cellKey(static_cast<int>(index), cells[index]);
+    }
+    colorRows.assign(useBitboards ? bitboardColors * height : 0, 0);
+    if (!useBitboards) {
+        typePlane.resize(cells.size());
+        for (size_t index = 0; index < cells.size(); index++) {
+            typePlane[index] = static_cast<int8_t>(cells[index].type);
         }
+        return;
     }
+    typePlane.clear();
 
-    return matches;
+    for (int row = 0; row < height; row++) {
+        for (int col = 0; col < width; col++) {
+            int type = cellAt(row, col).type;
+            if (type >= 0) {
+                colorRows[type * height + row] |= bit(col);
+            }
+        }
+    }
 }
 
-set<pair<int, int>> Match3Engine::findVerticalMatches(int col) {
-    set<pair<int, int>> matches;
+// Untimed, with its own scratch, so concurrent callers share nothing.
+BoardMask Match3Engine::findMatchMask() const {
+    BoardMask mask;
+    vector<uint64_t> starts;
+    vector<uint64_t> dirtyColumns;
+    scanMatches(mask, nullptr, starts, dirtyColumns);
+    return mask;
+}
 
-    if (height < 3) {
-        return matches;
-    }
+void Match3Engine::findMatchMask(BoardMask& mask, const BoardMask* dirty) {
+    MATCH3_TIME_PHASE(StatPhase::DETECTION);
+    scanMatches(mask, dirty, wideStarts, wideDirtyColumns);
+}
 
-    int currentType = grid[0][col].type;
-    int matchStart = 0;
-    int matchLength = 1;
+// With a dirty mask, horizontal runs are only looked for in rows holding a
+// dirty cell and vertical runs only in columns holding one. Inside a cascade
+// that finds every match: each cell of a run found on one pass is written
+// before the next pass, so any run on the next pass contains a written cell.
+void Match3Engine::scanMatches(BoardMask& mask, const BoardMask* dirty,
+                               vector<uint64_t>& wideScratch, vector<uint64_t>& wideColumnScratch) const {
+    mask.reset(width, height);
 
-    for (int row = 1; row < width; ++row) {
-        if (grid[row][col].type == currentType && currentType != EMPTY_CELL) {
-            matchLength++;
+    if (!useBitboards) {
+        findWideMatches(mask, dirty, wideScratch, wideColumnScratch);
+        return;
+    }
+
+    uint64_t dirtyColumns = ~uint64_t(0);
+    if (dirty) {
+        dirtyColumns = 0;
+        for (uint64_t word: dirty->words) {
+            dirtyColumns |= word;
         }
-        else {
-            if (matchLength >= 3) {
-                for (int row = matchStart; row < matchStart + matchLength; row++) {
-                    matches.insert({row, col});
-                }
-            }
+        if (dirtyColumns == 0) {
+            return;
+        }
+    }
 
-            currentType = grid[row][col].type;
-            matchStart = row;
-            matchLength = 1;
+    for (int type = 0; type < bitboardColors; type++) {
+        const uint64_t* rows = &colorRows[type * height];
+        for (int row = 0; row < height; row++) {
+            uint64_t above2 = row >= 2 ? rows[row - 2] : 0;
+            uint64_t above1 = row >= 1 ? rows[row - 1] : 0;
+            uint64_t below1 = row + 1 < height ? rows[row + 1] : 0;
+            uint64_t below2 = row + 2 < height ? rows[row + 2] : 0;
+            uint64_t runs = verticalRuns(above2, above1, rows[row], below1, below2) & dirtyColumns;
+            if (!dirty || dirty->words[row]) {
+                runs |= horizontalRuns(rows[row]);
+            }
+            mask.words[row] |= runs;
         }
     }
+}
 
-    if (matchLength >= 3) {
-        for (int row = matchStart; row < matchStart + matchLength; row++) {
-            matches.insert({row, col});
+void Match3Engine::findWideMatches(BoardMask& mask, const BoardMask* dirty,
+                                   vector<uint64_t>& starts, vector<uint64_t>& dirtyColumns) const {
+    const SimdKernels& kernels = simdKernels();
+    starts.resize(mask.wordsPerRow);
+
+    // Vertical scans cover the span of words that hold a dirty column.
+    int firstWord = 0;
+    int lastWord = mask.wordsPerRow - 1;
+    if (dirty) {
+        dirtyColumns.assign(mask.wordsPerRow, 0);
+        for (int row = 0; row < height; row++) {
+            for (int index = 0; index < mask.wordsPerRow; index++) {
+                dirtyColumns[index] |= dirty->words[row * mask.wordsPerRow + index];
+            }
+        }
+        while (firstWord <= lastWord && dirtyColumns[firstWord] == 0) {
+            firstWord++;
+        }
+        while (lastWord >= firstWord && dirtyColumns[lastWord] == 0) {
+            lastWord--;
+        }
+        if (firstWord > lastWord) {
+            return;
         }
     }
+    int firstColumn = firstWord * 64;
+    int columnCount = min(width, (lastWord + 1) * 64) - firstColumn;
+
+    for (int row = 0; row < height; row++) {
+        const int8_t* types = &typePlane[row * width];
+        uint64_t* out = &mask.words[row * mask.wordsPerRow];
+        bool rowDirty = !dirty;
+        for (int index = 0; index < mask.wordsPerRow && !rowDirty; index++) {
+            rowDirty = dirty->words[row * mask.wordsPerRow + index] != 0;
+        }
+
+        if (width >= 3 && rowDirty) {
+            fill(starts.begin(), starts.end(), 0);
+            kernels.runStarts(types, types + 1, types + 2, width - 2, starts.data());
+            // A run starting at column c covers c, c + 1 and c + 2.
+            uint64_t carry = 0;
+            for (int index = 0; index < mask.wordsPerRow; index++) {
+                uint64_t word = starts[index];
+                out[index] |= word | (word << 1) | (word << 2) | carry;
+                carry = (word >> 63) | (word >> 62);
+            }
+        }
 
-    return matches;
+        if (row + 2 < height) {
+            fill(starts.begin(), starts.end(), 0);
+            const int8_t* first = types + firstColumn;
+            kernels.runStarts(first, first + width, first + 2 * width, columnCount, &starts[firstWord]);
+            for (int index = firstWord; index <= lastWord; index++) {
+                out[index] |= starts[index];
+                out[index + mask.wordsPerRow] |= starts[index];
+                out[index + 2 * mask.wordsPerRow] |= starts[index];
+            }
+        }
+    }
 }
 
-set<pair<int, int>> Match3Engine::findAllMatches() {
+set<pair<int, int>> Match3Engine::findAllMatches() const {
     set<pair<int, int>> allMatches;
 
-    for (int row = 0; row < height; row++) {
-        auto matches = findHorizontalMatches(row);
-        allMatches.insert(matches.begin(), matches.end());
-    }
-    for (int col = 0; col < width; col++) {
-        auto matches = findVerticalMatches(col);
-        allMatches.insert(matches.begin(), matches.end());
-    }
+    findMatchMask().forEach([&](int row, int col) {
+        allMatches.insert(allMatches.end(), {row, col});
+    });
 
     return allMatches;
 }
 
+// Each column with a hole is compacted from an occupancy mask: the k-th
+// occupied cell from the bottom lands k rows above the bottom, so it falls
+// by its own height minus k (the portable form of a PEXT compaction). Only
+// cells that move are written, then the freed cells at the top are cleared.
 void Match3Engine::applyGravity() {
-    // Process mỗi column độc lập
+    MutationScope scope(*this);
+    MATCH3_TIME_PHASE(StatPhase::GRAVITY);
+    fallDistances.assign(cells.size(), 0);
+    const int occupancyWords = (height + 63) / 64;
+    columnOccupancy.resize(occupancyWords);
+
+    // Bitboard mode reads occupancy from the colour rows and skips every
+    // column without a hole before touching a cell.
+    uint64_t holeColumns = ~uint64_t(0);
+    if (useBitboards) {
+        occupiedRows.assign(height, 0);
+        for (int type = 0; type < bitboardColors; type++) {
+            for (int row = 0; row < height; row++) {
+                occupiedRows[row] |= colorRows[type * height + row];
+            }
+        }
+        uint64_t allColumns = width == 64 ? ~uint64_t(0) : bit(width) - 1;
+        holeColumns = 0;
+        for (int row = 0; row < height; row++) {
+            holeColumns |= ~occupiedRows[row] & allColumns;
+        }
+    }
+
     for (int col = 0; col < width; ++col) {
-        int writePos = height - 1;  // Start from bottom
-
-        // Scan từ dưới lên, collect non-empty items
-        for (int row = height - 1; row >= 0; --row) {
-            if (grid[row][col].type != EMPTY_CELL) {
-                // Move item to writePos
-                if (row != writePos) {
-                    grid[writePos][col] = grid[row][col];
-                    grid[row][col] = EMPTY_CELL;
+        if (useBitboards && !((holeColumns >> col) & 1)) {
+            continue;
+        }
+        fill(columnOccupancy.begin(), columnOccupancy.end(), 0);
+        int occupied = 0;
+        for (int index = 0; index < height; index++) {
+            int row = height - 1 - index;
+            uint64_t full = useBitboards ? (occupiedRows[row] >> col) & 1
+                                         : uint64_t(typePlane[row * width + col] != EMPTY_CELL);
+            columnOccupancy[index / 64] |= full << (index % 64);
+            occupied += static_cast<int>(full);
+        }
+        if (occupied == height) {
+            continue;
+        }
+
+        int rank = 0;
+        int fallSlot = -1;
+        int fallCount = 0;
+        for (int word = 0; word < occupancyWords; word++) {
+            for (uint64_t bits = columnOccupancy[word]; bits; bits &= bits - 1, rank++) {
+                int index = word * 64 + lowestBit(bits);
+                if (index == rank) {
+                    continue;
                 }
-                writePos--;  // Next write position moves up
+                int target = height - 1 - rank;
+                setCell(target, col, cellAt(height - 1 - index, col));
+                fallDistances[target * width + col] = index - rank;
+                if (events) {
+                    if (fallSlot < 0) {
+                        events->push(EventType::FALLS);
+                        events->push(col);
+                        fallSlot = events->reserve();
+                    }
+                    events->push(target);
+                    events->push(index - rank);
+                    fallCount++;
+                }
+            }
+        }
+        for (int row = 0; row < height - occupied; row++) {
+            if (cellAt(row, col).type != EMPTY_CELL) {
+                setCell(row, col, Cell());
             }
         }
+        if (fallSlot >= 0) {
+            events->patch(fallSlot, fallCount);
+        }
     }
 }
 
-void Match3Engine::refillSmart() {
-    random_device rd;
-    mt19937 gen(rd());
-    uniform_int_distribution<> dis(0, itemTypes - 1);
+int Match3Engine::getFallDistance(int row, int col) const {
+    if (!isInBounds(row, col) || fallDistances.empty()) {
+        return 0;
+    }
+    return fallDistances[row * width + col];
+}
 
+void Match3Engine::refillSmart() {
+    MutationScope scope(*this);
+    MATCH3_TIME_PHASE(StatPhase::REFILL);
+    refilledCells.reset(width, height);
     for (int row = 0; row < height; row++) {
         for (int col = 0; col < width; col++) {
-            if (grid[row][col].type == EMPTY_CELL) {
-                int newItem;
-                int attempts = 0;
-
-                do {
-                    newItem = dis(gen);
-                    attempts++;
-
-                    if (attempts >= MAX_ATTEMPTS) {
-                        cerr << "Warning: Forced to create match at ("
-                             << row << "," << col << ")\n";
-                        break;
-                    }
-                }
-                while (wouldCreateMatch(row, col, newItem));
-                grid[row][col] = newItem;
+            if (cellAt(row, col).type == EMPTY_CELL) {
+                setCell(row, col, drawRefillColor(row, col));
+                refilledCells.set(row, col);
             }
         }
     }
+    ensureMovesAfterRefill();
+    logRefill();
 }
 
-bool Match3Engine::wouldCreateMatch(int row, int col, int itemType) {
-    int originalItem = grid[row][col].type;
-    grid[row][col] = itemType;
-
-    bool hasHorizontalMatch = hasHorizontalMatchAt(row, col);
-    bool hasVerticalMatch = hasVerticalMatchAt(row, col);
-
-    grid[row][col] = originalItem;
-
-    return hasHorizontalMatch || hasVerticalMatch;
+void Match3Engine::logRefill() {
+    if (!events || refilledCells.empty()) {
+        return;
+    }
+    events->push(EventType::REFILLED);
+    events->push(refilledCells.count());
+    refilledCells.forEach([&](int row, int col) {
+        events->push(row);
+        events->push(col);
+        events->push(cellAt(row, col).type);
+    });
 }
 
-bool Match3Engine::hasHorizontalMatchAt(int row, int col) {
-    int itemType = grid[row][col].type;
+// The shared refill rule (see refillForbiddenColors()) on this board.
+uint64_t Match3Engine::forbiddenColors(int row, int col) const {
+    return refillForbiddenColors(row, col, [&](int r, int c) {
+        return r >= 0 && r < height && c >= 0 && c < width ? cells[r * width + c].type : EMPTY_CELL;
+    });
+}
 
-    int leftCount = 0;
-    for (int i = col - 1; i >= 0 && grid[row][i].type == itemType; i--) {
-        leftCount++;
+int Match3Engine::drawRefillColor(int row, int col) {
+    uint64_t allColors = itemTypes >= MAX_REFILL_COLORS ? ~uint64_t(0) : bit(itemTypes) - 1;
+    uint64_t allowed = allColors & ~forbiddenColors(row, col);
+    if (allowed == 0) {
+        // Every colour completes a run here; take any and let the cascade clear it.
+        allowed = allColors;
+        MATCH3_COUNT(refillFallbacks, 1);
     }
+    MATCH3_COUNT(refillCells, 1);
 
-    int rightCount = 0;
-    for (int i = col + 1; i < width && grid[row][i].type == itemType; i++) {
-        rightCount++;
+    for (int skip = rng.nextInt(popcount64(allowed)); skip > 0; skip--) {
+        allowed &= allowed - 1;
     }
-
-    int totalMatch = leftCount + 1 + rightCount;
-
-    return totalMatch >= 3;
+    return lowestBit(allowed);
 }
 
-bool Match3Engine::hasVerticalMatchAt(int row, int col) {
-    int itemType = grid[row][col].type;
-
-    int topCount = 0;
-    for (int i = row - 1; i >= 0 && grid[i][col].type == itemType; i--) {
-        topCount++;
+// Redraws the cells of the last refill, a bounded number of times, until
+// the board has at least minValidMovesAfterRefill valid moves.
+void Match3Engine::ensureMovesAfterRefill() {
+    if (minValidMovesAfterRefill <= 0 || refilledCells.empty()) {
+        return;
     }
 
-    int bottomCount = 0;
-    for (int i = row + 1; i < height && grid[i][col].type == itemType; i++) {
-        bottomCount++;
+    for (int pass = 0; pass < MAX_REFILL_PASSES; pass++) {
+        refreshMoveIndex();
+        if (validMoveCount >= minValidMovesAfterRefill) {
+            break;
+        }
+        MATCH3_COUNT(refillRedraws, 1);
+        refilledCells.forEach([&](int row, int col) {
+            setCell(row, col, Cell());
+        });
+        refilledCells.forEach([&](int row, int col) {
+            setCell(row, col, drawRefillColor(row, col));
+        });
     }
+}
 
-    int totalMatch = topCount + 1 + bottomCount;
+void Match3Engine::setMinValidMovesAfterRefill(int count) {
+    minValidMovesAfterRefill = count;
+}
 
-    return totalMatch >= 3;
+void Match3Engine::setMaxSpawnSteps(int steps) {
+    maxSpawnSteps = steps;
 }
 
 void Match3Engine::refillFromTop() {
-    random_device rd;
-    mt19937 gen(rd());
-    uniform_int_distribution<> dis(0, itemTypes);
-
+    MATCH3_TIME_PHASE(StatPhase::REFILL);
+    refilledCells.reset(width, height);
     for (int col = 0; col < width; col++) {
         int emptyCount = 0;
 
         for (int row = 0; row < height; row++) {
-            if (grid[row][col].type == EMPTY_CELL) {
+            if (cellAt(row, col).type == EMPTY_CELL) {
                 emptyCount++;
             }
         }
 
         for (int row = 0; row < emptyCount; row++) {
-            int newItem;
-            int attempts = 0;
-            do {
-                newItem = dis(gen);
-                attempts++;
-
-                if (attempts >= MAX_ATTEMPTS) {
-                    break;
-                }
-            }
-            while (wouldCreateMatch(row, col, newItem));
-            grid[row][col] = newItem;
+            setCell(row, col, drawRefillColor(row, col));
+            refilledCells.set(row, col);
         }
     }
+    ensureMovesAfterRefill();
+    logRefill();
 }
 
 int Match3Engine::processCascade() {
+    MutationScope scope(*this);
     int cascadeCount = 0;
 
     while (true) {
-        auto matches = findAllMatches();
-        if (matches.empty()) {
+        findMatchMask(matchScratch, cascadeCount == 0 ? nullptr : &cascadeDirty);
+        if (matchScratch.empty()) {
             break;
         }
         cascadeCount++;
-        removeMatches(matches);
+        cascadeDirty.clear();
+        removeMatches(matchScratch);
         applyGravity();
         refillFromTop();
     }
 
+    MATCH3_RECORD_CASCADE(cascadeCount);
     return cascadeCount;
 }
 
-void Match3Engine::removeMatches(const set<pair<int, int>> &matches) {
-    for (const auto& [row, col]: matches) {
-        grid[row][col] = EMPTY_CELL;
-    }
+void Match3Engine::removeMatches(const BoardMask& matches) {
+    matches.forEach([&](int row, int col) {
+        setCell(row, col, Cell());
+    });
 }
 
 bool Match3Engine::swap(int row1, int col1, int row2, int col2) {
-    if (!isInBounds(row1, col1) || !isInBounds(row1, col1)) {
-        return false;
+    return swapAndResolve(row1, col1, row2, col2, nullptr, 0) >= 0;
+}
+
+// Validation only reads the two cells' rows and columns, and the cascade
+// starts from the two written cells, so a move costs the same on any
+// board size. Both assume the board was stable before the move.
+int Match3Engine::swapAndResolve(int row1, int col1, int row2, int col2, int32_t* out, int capacity) {
+    MutationScope scope(*this);
+    if (!isValidSwap(row1, col1, row2, col2)) {
+        return -1;
     }
-    if (!isAdjacent(row1, col1, row2, col2)) {
-        return false;
+    bool specialSwap = activatesOnSwap(row1, col1, row2, col2);
+
+    EventLog log(out, capacity);
+    log.push(EventType::SWAP);
+    log.push(row1);
+    log.push(col1);
+    log.push(row2);
+    log.push(col2);
+
+    events = &log;
+    int steps;
+    if (specialSwap) {
+        steps = resolveSpecialSwap(row1, col1, row2, col2);
     }
-
-    std::swap(grid[row1][col1], grid[row2][col2]);
-    auto matches = findAllMatches();
-    if (matches.empty()) {
-        std::swap(grid[row1][col1], grid[row2][col2]);
-        return false;
+    else {
+        cascadeDirty.clear();
+        swapCells(row1, col1, row2, col2);
+        steps = cascadeWithSpecials(0, false);
+        MATCH3_RECORD_CASCADE(steps);
     }
+    events = nullptr;
 
-    processCascade();
-
-    return true;
+    log.push(EventType::END);
+    log.push(steps);
+    return log.size();
 }
 
-bool Match3Engine::isAdjacent(int row1, int col1, int row2, int col2) {
+bool Match3Engine::isAdjacent(int row1, int col1, int row2, int col2) const {
     int dx = abs(col1 - col2);
     int dy = abs(row1 - row2);
 
     return (dx == 1 && dy == 0) || (dx == 0 && dy == 1);
 }
 
-bool Match3Engine::isInBounds(int row, int col) {
+bool Match3Engine::isInBounds(int row, int col) const {
     return row >= 0 && row < height && col >= 0 && col < width;
 }
 
-bool Match3Engine::hasValidMoves() {
-    // Đổi chỗ mọi ô
-    // Kiểm tra có tồn tại match không
-    for (int row = 0; row < height; row++) {
-        for (int col = 0; col < width; col++) {
-            if (col < width - 1) {
-                if (wouldCreateMatchAfterSwap(row, col, row, col + 1)) {
-                    LOGD("Valid move: (%d, %d), (%d, %d)", row, col, row, col + 1);
-                    return true;
+bool Match3Engine::hasValidMoves() const {
+    return validMoveCount > 0;
+}
+
+void Match3Engine::refreshMoveIndex() {
+    MATCH3_TIME_PHASE(StatPhase::MOVE_SCAN);
+    if (moveIndexStale) {
+        horizontalMoves.reset(width, height);
+        verticalMoves.reset(width, height);
+        horizontalRecheck.reset(width, height);
+        verticalRecheck.reset(width, height);
+        validMoveCount = 0;
+        for (int row = 0; row < height; row++) {
+            for (int col = 0; col < width; col++) {
+                if (col < width - 1) {
+                    updateMove(horizontalMoves, row, col, row, col + 1);
                 }
-            }
-            if (row < height - 1) {
-                if (wouldCreateMatchAfterSwap(row, col, row + 1, col)) {
-                    LOGD("Valid move: (%d, %d), (%d, %d)", row, col, row + 1, col);
-                    return true;
+                if (row < height - 1) {
+                    updateMove(verticalMoves, row, col, row + 1, col);
                 }
             }
         }
+        moveDirty.clear();
+        moveIndexStale = false;
+        return;
     }
 
-    return false;
-}
+    if (moveDirty.empty()) {
+        return;
+    }
 
-void Match3Engine::shuffle() {
-    LOGD("Shuffling board...\n");
-    vector<int> items;
-    for (int row = 0; row < height; row++) {
-        for (int col = 0; col < width; col++) {
-            if (grid[row][col].type != EMPTY_CELL) {
-                items.push_back(grid[row][col].type);
+    // A swap only looks two cells past either end, so a changed cell (R, C)
+    // can affect horizontal swaps at rows R-2..R+2, cols C-3..C+2 and
+    // vertical swaps at rows R-3..R+2, cols C-2..C+2.
+    moveDirty.forEach([&](int dirtyRow, int dirtyCol) {
+        for (int row = max(0, dirtyRow - 2); row <= min(height - 1, dirtyRow + 2); row++) {
+            for (int col = max(0, dirtyCol - 3); col <= min(width - 2, dirtyCol + 2); col++) {
+                horizontalRecheck.set(row, col);
             }
         }
+        for (int row = max(0, dirtyRow - 3); row <= min(height - 2, dirtyRow + 2); row++) {
+            for (int col = max(0, dirtyCol - 2); col <= min(width - 1, dirtyCol + 2); col++) {
+                verticalRecheck.set(row, col);
+            }
+        }
+    });
+
+    horizontalRecheck.forEach([&](int row, int col) {
+        updateMove(horizontalMoves, row, col, row, col + 1);
+    });
+    verticalRecheck.forEach([&](int row, int col) {
+        updateMove(verticalMoves, row, col, row + 1, col);
+    });
+
+    horizontalRecheck.clear();
+    verticalRecheck.clear();
+    moveDirty.clear();
+}
+
+void Match3Engine::updateMove(BoardMask& moves, int row1, int col1, int row2, int col2) {
+    bool valid = wouldCreateMatchAfterSwap(row1, col1, row2, col2) || activatesOnSwap(row1, col1, row2, col2);
+    if (valid == moves.test(row1, col1)) {
+        return;
+    }
+    if (valid) {
+        moves.set(row1, col1);
+        validMoveCount++;
     }
-    random_device rd;
-    mt19937 gen(rd());
-    for (int i = items.size() - 1; i > 0; --i) {
-        uniform_int_distribution<> dis(0, i);
-        int j = dis(gen);
-        ::swap(items[i], items[j]);
+    else {
+        moves.unset(row1, col1);
+        validMoveCount--;
     }
+}
 
-    int idx = 0;
-    for (int row = 0; row < height; row++) {
-        for (int col = 0; col < width; col++) {
-            if (grid[row][col].type != EMPTY_CELL) {
-                grid[row][col] = items[idx++];
-            }
+bool Match3Engine::shuffle(int minValidMoves) {
+    MutationScope scope(*this);
+    MATCH3_TIME_PHASE(StatPhase::SHUFFLE);
+    MATCH3_COUNT(shuffleCalls, 1);
+    MATCH3_LOGI("Shuffling board...");
+    vector<Cell> original(cells.begin(), cells.end());
+
+    // Cells are grouped by colour so specials move together with their item.
+    vector<vector<Cell>> buckets;
+    for (const Cell& cell: cells) {
+        if (cell.type == EMPTY_CELL) {
+            continue;
         }
+        if (cell.type >= static_cast<int>(buckets.size())) {
+            buckets.resize(cell.type + 1);
+        }
+        buckets[cell.type].push_back(cell);
     }
 
-    if (!hasValidMoves()) {
-        LOGD("Shuffle didn't create moves, shuffling again...\n");
-        shuffle();
+    // A move needs three cells of one colour.
+    bool enoughForMove = false;
+    for (const vector<Cell>& bucket: buckets) {
+        enoughForMove |= bucket.size() >= 3;
+    }
+    if (!enoughForMove && minValidMoves > 0) {
+        MATCH3_LOGW("Shuffle failed: no colour has three items");
+        MATCH3_COUNT(shuffleFailures, 1);
+        return false;
     }
-}
 
-int Match3Engine::countValidMoves() {
-    int count = 0;
-    for (int row = 0; row < height; row++) {
-        for (int col = 0; col < width; col++) {
-            if (col < width - 1) {
-                if (wouldCreateMatchAfterSwap(row, col, row, col + 1)) {
-                    LOGD("Valid move: (%d, %d), (%d, %d)", row, col, row, col + 1);
-                    count++;
+    vector<int> remaining(buckets.size());
+    for (int attempt = 0; attempt < MAX_SHUFFLE_ATTEMPTS; attempt++) {
+        MATCH3_COUNT(shuffleAttempts, 1);
+        for (vector<Cell>& bucket: buckets) {
+            for (int i = static_cast<int>(bucket.size()) - 1; i > 0; --i) {
+                ::swap(bucket[i], bucket[rng.nextInt(i + 1)]);
+            }
+        }
+        for (size_t color = 0; color < buckets.size(); color++) {
+            remaining[color] = buckets[color].size();
+        }
+        for (int row = 0; row < height; row++) {
+            for (int col = 0; col < width; col++) {
+                if (original[row * width + col].type != EMPTY_CELL) {
+                    setCell(row, col, Cell());
                 }
             }
-            if (row < height - 1) {
-                if (wouldCreateMatchAfterSwap(row, col, row + 1, col)) {
-                    LOGD("Valid move: (%d, %d), (%d, %d)", row, col, row + 1, col);
-                    count++;
+        }
+
+        // Place in row-major order, drawing each colour in proportion to how
+        // many of its items are left, but never one that completes a run.
+        bool placedWithoutRuns = true;
+        for (int row = 0; row < height; row++) {
+            for (int col = 0; col < width; col++) {
+                if (original[row * width + col].type == EMPTY_CELL) {
+                    continue;
+                }
+                uint64_t forbidden = forbiddenColors(row, col);
+                auto isAllowed = [&](int color) {
+                    return remaining[color] > 0 && (color >= MAX_REFILL_COLORS || !(forbidden & bit(color)));
+                };
+                int total = 0;
+                for (size_t color = 0; color < remaining.size(); color++) {
+                    total += isAllowed(color) ? remaining[color] : 0;
+                }
+                if (total == 0) {
+                    placedWithoutRuns = false;
+                    break;
+                }
+
+                int pick = rng.nextInt(total);
+                int color = 0;
+                while (!isAllowed(color) || pick >= remaining[color]) {
+                    pick -= isAllowed(color) ? remaining[color] : 0;
+                    color++;
                 }
+                setCell(row, col, buckets[color][--remaining[color]]);
+            }
+            if (!placedWithoutRuns) {
+                break;
+            }
+        }
+
+        if (placedWithoutRuns) {
+            refreshMoveIndex();
+            if (validMoveCount >= minValidMoves) {
+                return true;
+            }
+        }
+        MATCH3_LOGD("Shuffle attempt %d failed, retrying...", attempt + 1);
+
+        for (int row = 0; row < height; row++) {
+            for (int col = 0; col < width; col++) {
+                setCell(row, col, original[row * width + col]);
             }
         }
     }
 
-    return count;
+    MATCH3_LOGW("Shuffle failed after %d attempts", MAX_SHUFFLE_ATTEMPTS);
+    MATCH3_COUNT(shuffleFailures, 1);
+    return false;
 }
 
-bool Match3Engine::wouldCreateMatchAfterSwap(int row1, int col1, int row2, int col2) {
-    ::swap(grid[row1][col1], grid[row2][col2]);
-    bool hasMatch = checkMatchAt(row1, col1) || checkMatchAt(row2, col2);
-    ::swap(grid[row1][col1], grid[row2][col2]);
-    return hasMatch;
+EngineStats Match3Engine::getStats() const {
+    return stats;
 }
 
-bool Match3Engine::checkMatchAt(int row, int col) {
-    return hasHorizontalMatchAt(row, col) || hasVerticalMatchAt(row, col);
+void Match3Engine::resetStats() {
+    stats = EngineStats();
+#ifdef MATCH3_ENABLE_STATS
+    stats.enabled = true;
+#endif
 }
 
-optional<Move> Match3Engine::findHint() {
+int Match3Engine::countValidMoves() const {
+    return validMoveCount;
+}
+
+bool Match3Engine::isValidSwap(int row1, int col1, int row2, int col2) const {
+    if (!isInBounds(row1, col1) || !isInBounds(row2, col2) || !isAdjacent(row1, col1, row2, col2)) {
+        return false;
+    }
+    return wouldCreateMatchAfterSwap(row1, col1, row2, col2) || activatesOnSwap(row1, col1, row2, col2);
+}
+
+// Two specials, or a colour bomb and any item, fire without a match.
+bool Match3Engine::activatesOnSwap(int row1, int col1, int row2, int col2) const {
+    const Cell& first = cellAt(row1, col1);
+    const Cell& second = cellAt(row2, col2);
+    if (first.type == EMPTY_CELL || second.type == EMPTY_CELL) {
+        return false;
+    }
+    return (first.specialType != SpecialType::NONE && second.specialType != SpecialType::NONE) ||
+           first.specialType == SpecialType::COLOR_BOMB || second.specialType == SpecialType::COLOR_BOMB;
+}
+
+// Reads the board as if the two cells were swapped instead of swapping
+// them, so it is safe to call from several threads at once.
+bool Match3Engine::wouldCreateMatchAfterSwap(int row1, int col1, int row2, int col2) const {
+    int first = cellAt(row1, col1).type;
+    int second = cellAt(row2, col2).type;
+    return hasMatchThrough(row1, col1, second, row2, col2, first) ||
+           hasMatchThrough(row2, col2, first, row1, col1, second);
+}
+
+// Whether (row, col), holding `type`, is in a run of three or more while
+// (otherRow, otherCol) holds `otherType`; every other cell is read as is.
+// Empty cells never match, however many line up.
+bool Match3Engine::hasMatchThrough(int row, int col, int type, int otherRow, int otherCol, int otherType) const {
+    if (type == EMPTY_CELL) {
+        return false;
+    }
+    auto typeAt = [&](int r, int c) {
+        return r == otherRow && c == otherCol ? otherType : cellAt(r, c).type;
+    };
+
+    int horizontal = 1;
+    for (int i = col - 1; i >= 0 && typeAt(row, i) == type; i--) {
+        horizontal++;
+    }
+    for (int i = col + 1; i < width && typeAt(row, i) == type; i++) {
+        horizontal++;
+    }
+    if (horizontal >= 3) {
+        return true;
+    }
+
+    int vertical = 1;
+    for (int i = row - 1; i >= 0 && typeAt(i, col) == type; i--) {
+        vertical++;
+    }
+    for (int i = row + 1; i < height && typeAt(i, col) == type; i++) {
+        vertical++;
+    }
+    return vertical >= 3;
+}
+
+optional<Move> Match3Engine::findHint() const {
+    if (validMoveCount == 0) {
+        return nullopt;
+    }
+
+    // Scan order matches a cell-by-cell walk: for each cell, the swap with
+    // its right neighbour comes before the swap with the cell below.
     for (int row = 0; row < height; row++) {
-        for (int col = 0; col < width; col++) {
-            if (col < width - 1) {
-                if (wouldCreateMatchAfterSwap(row, col, row, col + 1)) {
-                    return Move{row, col, row, col + 1};
-                }
+        for (int index = 0; index < horizontalMoves.wordsPerRow; index++) {
+            uint64_t horizontal = horizontalMoves.words[row * horizontalMoves.wordsPerRow + index];
+            uint64_t vertical = verticalMoves.words[row * verticalMoves.wordsPerRow + index];
+            if ((horizontal | vertical) == 0) {
+                continue;
             }
-            if (row < height - 1) {
-                if (wouldCreateMatchAfterSwap(row, col, row + 1, col)) {
-                    return Move{row, col, row + 1, col};
-                }
+            int col = index * 64 + lowestBit(horizontal | vertical);
+            if (horizontalMoves.test(row, col)) {
+                return Move{row, col, row, col + 1};
             }
+            return Move{row, col, row + 1, col};
         }
     }
 
     return nullopt;
-}
\ No newline at end of file
+}
+
+vector<Move> Match3Engine::findValidMoves() const {
+    vector<Move> moves;
+    moves.reserve(validMoveCount);
+    for (int row = 0; row < height; row++) {
+        for (int index = 0; index < horizontalMoves.wordsPerRow; index++) {
+            uint64_t horizontal = horizontalMoves.words[row * horizontalMoves.wordsPerRow + index];
+            uint64_t vertical = verticalMoves.words[row * verticalMoves.wordsPerRow + index];
+            for (uint64_t word = horizontal | vertical; word; word &= word - 1) {
+                int bitIndex = lowestBit(word);
+                int col = index * 64 + bitIndex;
+                if ((horizontal >> bitIndex) & 1) {
+                    moves.push_back({row, col, row, col + 1});
+                }
+                if ((vertical >> bitIndex) & 1) {
+                    moves.push_back({row, col, row + 1, col});
+                }
+            }
+        }
+    }
+    return moves;
+}
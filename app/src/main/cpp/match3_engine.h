@@ -5,8 +5,14 @@
 #ifndef MATCH3ENGINE_MATCH3_ENGINE_H
 #define MATCH3ENGINE_MATCH3_ENGINE_H
 
+#include <optional>
 #include <set>
 #include <utility>
+#include <vector>
+#include "match3_bitboard.h"
+#include "match3_events.h"
+#include "match3_random.h"
+#include "match3_stats.h"
 using namespace std;
 
 struct Move {
@@ -38,9 +44,207 @@ struct Cell {
     Cell(int t) : type(t), specialType(SpecialType::NONE) {}
 };
 
+// Two 32-bit ints, (type, special), so a board is the same flat int pairs
+// the JNI layer passes around and can live in a native-order direct buffer.
+static_assert(sizeof(Cell) == 2 * sizeof(int32_t), "Cell must be two int32 fields");
+
+// One-byte cell for snapshots and large simulation runs: colour in the low
+// four bits (EMPTY_COLOR marks an empty cell, so colours 0..14), special
+// type in the next three, and the top bit kept spare for blockers. A 9x9
+// board packs into 81 bytes. The engine converts at its edges
+// (exportPacked()/importPacked()) and keeps Cell inside.
+struct PackedCell {
+    static constexpr uint8_t EMPTY_COLOR = 15;
+    static constexpr int MAX_COLORS = 15;
+    static constexpr uint8_t BLOCKER = 0x80;
+
+    uint8_t bits = EMPTY_COLOR;
+
+    int type() const {
+        int color = bits & 15;
+        return color == EMPTY_COLOR ? -1 : color;
+    }
+    SpecialType specialType() const { return static_cast<SpecialType>((bits >> 4) & 7); }
+    bool isBlocker() const { return bits & BLOCKER; }
+    // The special bits can hold 5..7, which no SpecialType uses.
+    bool hasKnownSpecial() const { return specialType() <= SpecialType::COLOR_BOMB; }
+
+    Cell unpack() const {
+        Cell cell(type());
+        cell.specialType = specialType();
+        return cell;
+    }
+
+    // False, leaving `out` alone, if the colour is neither empty nor 0..14.
+    static bool pack(const Cell& cell, PackedCell& out) {
+        if (cell.type < -1 || cell.type >= MAX_COLORS) {
+            return false;
+        }
+        int color = cell.type < 0 ? EMPTY_COLOR : cell.type;
+        out.bits = static_cast<uint8_t>(color | (static_cast<int>(cell.specialType) << 4));
+        return true;
+    }
+};
+
+static_assert(sizeof(PackedCell) == 1, "PackedCell must be one byte");
+
+// Board cells, either owned or living in caller-provided memory (e.g. a
+// direct ByteBuffer shared with Java). Copies always own their cells.
+class CellStorage {
+public:
+    CellStorage() = default;
+
+    CellStorage(const CellStorage& other) {
+        assign(other.begin(), other.size());
+    }
+
+    CellStorage& operator=(const CellStorage& other) {
+        if (this != &other) {
+            assign(other.begin(), other.size());
+        }
+        return *this;
+    }
+
+    // Keeps external memory when it already holds `count` cells.
+    void resize(size_t count) {
+        if (external && count == cellCount) {
+            return;
+        }
+        owned.resize(count);
+        data = owned.data();
+        cellCount = count;
+        external = false;
+    }
+
+    void attach(Cell* board, size_t count) {
+        owned.clear();
+        data = board;
+        cellCount = count;
+        external = true;
+    }
+
+    void detach() {
+        if (external) {
+            assign(data, cellCount);
+        }
+    }
+
+    // Stops using external memory without copying it out.
+    void release() {
+        if (external) {
+            data = nullptr;
+            cellCount = 0;
+            external = false;
+        }
+    }
+
+    bool isExternal() const { return external; }
+    size_t size() const { return cellCount; }
+    Cell* begin() { return data; }
+    Cell* end() { return data + cellCount; }
+    const Cell* begin() const { return data; }
+    const Cell* end() const { return data + cellCount; }
+    Cell& operator[](size_t index) { return data[index]; }
+    const Cell& operator[](size_t index) const { return data[index]; }
+
+private:
+    void assign(const Cell* source, size_t count) {
+        owned.assign(source, source + count);
+        data = owned.data();
+        cellCount = count;
+        external = false;
+    }
+
+    vector<Cell> owned;
+    Cell* data = nullptr;
+    size_t cellCount = 0;
+    bool external = false;
+};
+
+// Cells of one match: at most a horizontal run along `row` and a vertical
+// run along `col`, crossing at (row, col) when both are present. Stored as
+// two spans, so a match never allocates. Iterates like the set it replaced:
+// (row, col) pairs in row-major order, without duplicates.
+struct MatchCells {
+    int row = -1;
+    int col = -1;
+    int firstCol = 0;
+    int lastCol = -1;
+    int firstRow = 0;
+    int lastRow = -1;
+
+    void setHorizontal(int runRow, int first, int last) {
+        row = runRow;
+        firstCol = first;
+        lastCol = last;
+    }
+
+    void setVertical(int runCol, int first, int last) {
+        col = runCol;
+        firstRow = first;
+        lastRow = last;
+    }
+
+    bool hasHorizontal() const { return lastCol >= firstCol; }
+    bool hasVertical() const { return lastRow >= firstRow; }
+
+    size_t size() const {
+        int horizontal = lastCol - firstCol + 1;
+        int vertical = lastRow - firstRow + 1;
+        if (hasHorizontal() && hasVertical()) {
+            return horizontal + vertical - 1;
+        }
+        return hasHorizontal() ? horizontal : max(vertical, 0);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_t count(const pair<int, int>& cell) const {
+        bool inHorizontal = cell.first == row && cell.second >= firstCol && cell.second <= lastCol;
+        bool inVertical = cell.second == col && cell.first >= firstRow && cell.first <= lastRow;
+        return inHorizontal || inVertical ? 1 : 0;
+    }
+
+    // The index-th cell in row-major order: vertical cells above the
+    // crossing row, then the horizontal run, then the cells below it.
+    pair<int, int> at(int index) const {
+        if (!hasVertical()) {
+            return {row, firstCol + index};
+        }
+        if (!hasHorizontal()) {
+            return {firstRow + index, col};
+        }
+        int above = row - firstRow;
+        if (index < above) {
+            return {firstRow + index, col};
+        }
+        index -= above;
+        int horizontal = lastCol - firstCol + 1;
+        if (index < horizontal) {
+            return {row, firstCol + index};
+        }
+        return {row + 1 + index - horizontal, col};
+    }
+
+    struct Iterator {
+        const MatchCells* cells;
+        int index;
+        pair<int, int> operator*() const { return cells->at(index); }
+        Iterator& operator++() { index++; return *this; }
+        bool operator!=(const Iterator& other) const { return index != other.index; }
+    };
+
+    Iterator begin() const { return {this, 0}; }
+    Iterator end() const { return {this, static_cast<int>(size())}; }
+};
+
 struct MatchResult {
     MatchPattern pattern;
-    set<pair<int, int>> cells;
+    // What spawnSpecialCell() leaves at the epicenter.
+    SpecialType specialType;
+    MatchCells cells;
     pair<int, int> epicenter;
     int itemType;
 };
@@ -50,44 +254,240 @@ private:
     int width;
     int height;
     int itemTypes;
-    vector<vector<Cell>> grid;
-    const int EMPTY_CELL = -1;
-    const int MAX_ATTEMPTS = 100;
+    // Engine-owned generator for the initial board, refills and shuffles.
+    Match3Random rng;
+    // Row-major board storage: cell (row, col) lives at cells[row * width + col].
+    CellStorage cells;
+    // XOR of zobristKey() over all cells (see match3_zobrist.h), updated by
+    // setCell() and recomputed by rebuildBoardViews().
+    uint64_t boardHash = 0;
+    // Bitboard mode (width <= BITBOARD_MAX_WIDTH): bit `col` of
+    // colorRows[type * height + row] is set when cell (row, col) holds `type`.
+    // Kept in sync by setCell(), which every board write goes through.
+    bool useBitboards;
+    int bitboardColors;
+    vector<uint64_t> colorRows;
+    // Wider boards keep one int8_t type per cell (row-major) for the SIMD
+    // run kernels instead.
+    vector<int8_t> typePlane;
+    // Valid-move index: bit (row, col) of horizontalMoves/verticalMoves is set
+    // when swapping (row, col) with its right/lower neighbour makes a match.
+    // setCell() marks changed cells in moveDirty; refreshMoveIndex() then
+    // re-checks only the swaps within reach of those cells. Every public
+    // mutator refreshes it before returning (see MutationScope), so the
+    // const queries read it without writing anything.
+    BoardMask horizontalMoves;
+    BoardMask verticalMoves;
+    BoardMask moveDirty;
+    BoardMask horizontalRecheck;
+    BoardMask verticalRecheck;
+    int validMoveCount;
+    bool moveIndexStale;
+    // Cells written since the current cascade step started; the next step
+    // only re-runs detection through their rows and columns.
+    BoardMask cascadeDirty;
+    // Cells written since the last writeChangedCells(), for renderers.
+    BoardMask changedCells;
+    // Cells holding a special, kept by setCell() like the bitboards.
+    BoardMask specialCells;
+    // Special activation scratch for one cascade step: the cells to clear,
+    // the new specials they must spare, the specials already fired, one
+    // blast, and the queue of specials waiting to fire.
+    BoardMask clearScratch;
+    BoardMask keepScratch;
+    BoardMask firedScratch;
+    BoardMask blastScratch;
+    vector<pair<int, int>> activationQueue;
+    BoardMask matchScratch;
+    // Per-step scratch reused across cascade steps, so steady-state cascades
+    // do not allocate.
+    vector<MatchResult> patternScratch;
+    BoardMask processedScratch;
+    vector<uint64_t> wideStarts;
+    vector<uint64_t> wideDirtyColumns;
+    // Gravity scratch: occupied columns of each row (bitboard mode) and one
+    // column's occupancy, bit i being the cell i rows above the bottom.
+    vector<uint64_t> occupiedRows;
+    vector<uint64_t> columnOccupancy;
+    // Rows each item fell in the last applyGravity(), at its new cell.
+    vector<int> fallDistances;
+    static constexpr int EMPTY_CELL = -1;
+    // Refill samples colours from a 64-bit allowed set.
+    static constexpr int MAX_REFILL_COLORS = 64;
+    static constexpr int MAX_CASCADES = 100;
+    static constexpr int DEFAULT_MAX_SPAWN_STEPS = 10;
+    static constexpr int MAX_REFILL_PASSES = 8;
+    static constexpr int MAX_SHUFFLE_ATTEMPTS = 32;
+    int minValidMovesAfterRefill = 0;
+    int maxSpawnSteps = DEFAULT_MAX_SPAWN_STEPS;
+    BoardMask refilledCells;
+    // Set by swapAndResolve() while it runs; the cascade steps report what
+    // they do here.
+    EventLog* events = nullptr;
+    // Always present so the layout does not depend on MATCH3_ENABLE_STATS;
+    // only written when it is defined.
+    EngineStats stats;
+    int mutationDepth = 0;
+
+    // Held by each public mutator. When the outermost one ends, the
+    // valid-move index is brought up to date, once, however many nested
+    // mutators ran.
+    class MutationScope {
+    public:
+        explicit MutationScope(Match3Engine& engine) : engine(engine) {
+            engine.mutationDepth++;
+        }
+        ~MutationScope() {
+            if (--engine.mutationDepth == 0) {
+                engine.refreshMoveIndex();
+            }
+        }
+    private:
+        Match3Engine& engine;
+    };
 
 private:
-    set<pair<int, int>> findHorizontalMatches(int row);
-    set<pair<int, int>> findVerticalMatches(int col);
-    void refillSmart();
+    Cell& cellAt(int row, int col) { return cells[row * width + col]; }
+    const Cell& cellAt(int row, int col) const { return cells[row * width + col]; }
+    void setCell(int row, int col, const Cell& cell);
+    void swapCells(int row1, int col1, int row2, int col2);
+    void rebuildBoardViews();
+    void resizeBoard(int width, int height);
+    void findMatchMask(BoardMask& mask, const BoardMask* dirty);
+    void scanMatches(BoardMask& mask, const BoardMask* dirty,
+                     vector<uint64_t>& wideScratch, vector<uint64_t>& wideColumnScratch) const;
+    void findWideMatches(BoardMask& mask, const BoardMask* dirty,
+                         vector<uint64_t>& starts, vector<uint64_t>& dirtyColumns) const;
+    void collectPatterns(const BoardMask& matches, BoardMask& processed, vector<MatchResult>& out) const;
+    const vector<MatchResult>& collectPatternMatches(const BoardMask* dirty);
+    void refreshMoveIndex();
+    void updateMove(BoardMask& moves, int row1, int col1, int row2, int col2);
     void refillFromTop();
-    void removeMatches(const set<pair<int, int>>& matches);
-    bool wouldCreateMatch(int row, int col, int itemType);
-    bool hasVerticalMatchAt(int row, int col);
-    bool hasHorizontalMatchAt(int row, int col);
-    bool isInBounds(int row, int col);
-    bool isAdjacent(int row1, int col1, int row2, int col2);
-    bool wouldCreateMatchAfterSwap(int row1, int col1, int row2, int col2);
-    bool checkMatchAt(int row, int col);
+    void removeMatches(const BoardMask& matches);
+    uint64_t forbiddenColors(int row, int col) const;
+    int drawRefillColor(int row, int col);
+    void ensureMovesAfterRefill();
+    void logRefill();
+    bool hasMatchThrough(int row, int col, int type, int otherRow, int otherCol, int otherType) const;
+    bool isInBounds(int row, int col) const;
+    bool isAdjacent(int row1, int col1, int row2, int col2) const;
+    bool wouldCreateMatchAfterSwap(int row1, int col1, int row2, int col2) const;
+    bool activatesOnSwap(int row1, int col1, int row2, int col2) const;
+    void addColorCells(BoardMask& mask, int type) const;
+    void addBlast(BoardMask& blast, int row, int col, const Cell& cell) const;
+    void addSwapBlast(BoardMask& blast, int row, int col, const Cell& moved, const Cell& other);
+    void queueSpecials(const BoardMask& cells, const BoardMask* keep);
+    void detonateSpecials(BoardMask& region, const BoardMask& keep);
+    void logMatched(int step, const BoardMask& cells);
+    void logActivation(int row, int col, SpecialType special, const BoardMask& cells);
+    void clearRegion(BoardMask& region, const BoardMask& keep);
+    int cascadeWithSpecials(int steps, bool fullScan);
+    int settleMatches(int steps);
+    int resolveSpecialSwap(int row1, int col1, int row2, int col2);
 
 public:
     Match3Engine(int width, int height, int itemTypes);
-    set<pair<int, int>> findAllMatches();
-    void setGrid(vector<vector<Cell>> grid);
-    int getItem(int col, int row);
+    Match3Engine(int width, int height, int itemTypes, uint64_t seed);
+    void setSeed(uint64_t seed, uint64_t stream = 0);
+    RandomState getRandomState() const;
+    void setRandomState(const RandomState& state);
+    set<pair<int, int>> findAllMatches() const;
+    BoardMask findMatchMask() const;
+    // Writes into an attached board of the same width and height; any
+    // other shape detaches it first (see isBoardAttached()).
+    void setGrid(const vector<vector<Cell>>& grid);
+    // Writes the board as width * height row-major PackedCells. Returns
+    // false, with `out` untouched, if `capacity` is too small or a colour
+    // does not fit in a PackedCell.
+    bool exportPacked(PackedCell* out, int capacity) const;
+    // Replaces the board with a packed snapshot, like setGrid() (the same
+    // rule for an attached board). Returns false, with the board unchanged,
+    // if `board` is null, the size is not positive or a cell holds special
+    // bits beyond COLOR_BOMB.
+    bool importPacked(const PackedCell* board, int width, int height);
+    // Uses caller-owned memory (e.g. a direct ByteBuffer shared with Java)
+    // as the board: width * height row-major cells, read and written in
+    // place. Returns false if `board` is null or the size is not positive.
+    bool attachBoard(Cell* board, int width, int height);
+    // Copies an attached board back into engine-owned storage.
+    void detachBoard();
+    bool isBoardAttached() const;
+    // Call after the owner of an attached board writes to it directly.
+    void boardChanged();
+    // Writes up to `capacity` (row, col) pairs of the current matches into
+    // `out` and returns the number of matched cells.
+    int writeMatches(int32_t* out, int capacity) const;
+    // Same for the cells written since the last call, which it then forgets,
+    // so `capacity` should cover the whole board.
+    int writeChangedCells(int32_t* out, int capacity);
+    int getItem(int col, int row) const;
+    // Zobrist hash of the cells (type and special). Equal boards hash the
+    // same whatever moves led to them.
+    uint64_t getBoardHash() const;
     void applyGravity();
+    // How many rows the item now at (row, col) fell in the last
+    // applyGravity(); 0 if it did not move or the cell is out of bounds.
+    int getFallDistance(int row, int col) const;
+    void refillSmart();
     int processCascade();
-    bool hasValidMoves();
-    void shuffle();
-    int countValidMoves();
-    optional<Move> findHint();
-    MatchResult detectPatternAt(int row, int col);
-    MatchPattern analyzeMatchPattern(int row, int col, int left, int right, int up, int down);
+    // The queries below are const and never write to the engine, so any
+    // number of threads may call them on one engine that nobody mutates.
+    bool hasValidMoves() const;
+    // Rearranges the items so the board has no matches and at least
+    // `minValidMoves` valid moves. Tries at most MAX_SHUFFLE_ATTEMPTS times;
+    // on failure the board is left unchanged and false is returned.
+    bool shuffle(int minValidMoves = 1);
+    // Refills redraw their new cells (a bounded number of times) until the
+    // board has at least `count` valid moves. 0 disables the check.
+    void setMinValidMovesAfterRefill(int count);
+    // Only the first `steps` steps of a cascade spawn new specials; later
+    // matches are plain clears, though specials already on the board still
+    // fire. On large boards blasts reshuffle enough cells to keep making
+    // 4s and 5s, so without a limit chains can run for the whole
+    // MAX_CASCADES. Cascades on boards of 9x9 or so stay well below the
+    // default of 10. 0 lets every step spawn.
+    void setMaxSpawnSteps(int steps);
+    int countValidMoves() const;
+    optional<Move> findHint() const;
+    // Every valid swap, in findHint() scan order.
+    vector<Move> findValidMoves() const;
+    // Whether swapping the two cells would make a match, evaluated on a
+    // virtual overlay of the board (the swapped cells substituted on read),
+    // or fires specials: two specials, or a colour bomb with anything.
+    bool isValidSwap(int row1, int col1, int row2, int col2) const;
+    MatchResult detectPatternAt(int row, int col) const;
+    // Pattern of a cell with runs of `left`, `right`, `up` and `down` equal
+    // cells beside it; one lookup in a compile-time table.
+    MatchPattern analyzeMatchPattern(int left, int right, int up, int down) const;
     void spawnSpecialCell(const MatchResult& match);
-    SpecialType getSpecialType(int row, int col);
-    int countConsecutive(int row, int col, int dx, int dy, int itemType);
-    bool isLPattern(int row, int col, int left, int right, int up, int down);
-    bool isTPattern(int row, int col, int left, int right, int up, int down);
-    vector<MatchResult> findAllMatchesWithPatterns();
+    SpecialType getSpecialType(int row, int col) const;
+    int countConsecutive(int row, int col, int dx, int dy, int itemType) const;
+    vector<MatchResult> findAllMatchesWithPatterns() const;
+    // Clears matches until the board is stable, leaving specials for 4s, 5s,
+    // Ls and Ts. A matched special fires: striped clears its row or column,
+    // wrapped the 3x3 around it, a colour bomb every cell of its colour.
+    // Specials caught in a blast fire in turn, within the same step. Only
+    // the first setMaxSpawnSteps() steps spawn specials; a cascade still
+    // unstable after MAX_CASCADES steps has its leftover matches redrawn in
+    // place, without firing specials, so the board always ends stable.
     int processCascadeWithSpecials();
+    // swapAndResolve() without the event stream. Returns false if the
+    // swap is not a valid move and the board is unchanged.
     bool swap(int row1, int col1, int row2, int col2);
+    // A valid swap (see isValidSwap()) plus the whole cascade with
+    // specials, reported as an event stream (see match3_events.h) written
+    // into `out`. Returns the stream
+    // length, which may exceed `capacity` (the stream is then truncated),
+    // or -1 if the swap is not a valid move and the board is unchanged.
+    // Swapping two specials fires a combination at the second cell:
+    // striped + striped clears a row and a column, striped + wrapped three
+    // of each, wrapped + wrapped a 5x5, a colour bomb fires every cell of
+    // the other's colour as the other's special, and two bombs clear the
+    // board.
+    int swapAndResolve(int row1, int col1, int row2, int col2, int32_t* out, int capacity);
+    // Counters and timers since construction or the last resetStats(); all
+    // zero (and `enabled` false) unless built with MATCH3_ENABLE_STATS.
+    EngineStats getStats() const;
+    void resetStats();
 };
 #endif //MATCH3ENGINE_MATCH3_ENGINE_H
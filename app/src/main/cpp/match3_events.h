@@ -0,0 +1,71 @@
+#ifndef MATCH3ENGINE_MATCH3_EVENTS_H
+#define MATCH3ENGINE_MATCH3_EVENTS_H
+
+#include <cstdint>
+
+// Packed int32 event stream written by Match3Engine::swapAndResolve(), in
+// the order a renderer animates it. Each event is its tag followed by:
+//   SWAP      row1, col1, row2, col2
+//   STEP      step (1 for the first cascade step)
+//   MATCHED   count, then count x (row, col) of the matched cells, each
+//             once, in row-major order
+//   SPECIAL   row, col, type, specialType of a special left in place of
+//             a matched cell
+//   ACTIVATED row, col, specialType of a special that fired, count, then
+//             count x (row, col) of the cells its blast added to the
+//             step's removals. A special swap reports one ACTIVATED at the
+//             second cell for the combined blast of both.
+//   FALLS     col, count, then count x (toRow, distance)
+//   REFILLED  count, then count x (row, col, type)
+//   END       number of cascade steps
+enum class EventType : int32_t {
+    SWAP = 1,
+    STEP,
+    MATCHED,
+    SPECIAL,
+    FALLS,
+    REFILLED,
+    END,
+    ACTIVATED
+};
+
+// Appends to a caller-provided buffer. Values past `capacity` are dropped
+// but still counted, so size() is the room the whole stream needs.
+class EventLog {
+public:
+    EventLog(int32_t* out, int capacity): out(out), capacity(capacity) {}
+
+    void push(int32_t value) {
+        if (length < capacity) {
+            out[length] = value;
+        }
+        length++;
+    }
+
+    void push(EventType type) {
+        push(static_cast<int32_t>(type));
+    }
+
+    // Leaves a slot (e.g. for a count) to be filled in later with patch().
+    int reserve() {
+        push(0);
+        return length - 1;
+    }
+
+    void patch(int position, int32_t value) {
+        if (position < capacity) {
+            out[position] = value;
+        }
+    }
+
+    int size() const {
+        return length;
+    }
+
+private:
+    int32_t* out;
+    int capacity;
+    int length = 0;
+};
+
+#endif //MATCH3ENGINE_MATCH3_EVENTS_H
@@ -0,0 +1,146 @@
+#include "match3_log.h"
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#define LOG_TAG "Match3Engine"
+#ifdef __ANDROID__
+#include <android/log.h>
+#endif
+using namespace std;
+
+static void writeLine(int level, const char* text) {
+#ifdef __ANDROID__
+    static const int priorities[] = {ANDROID_LOG_SILENT, ANDROID_LOG_ERROR, ANDROID_LOG_WARN,
+                                     ANDROID_LOG_INFO, ANDROID_LOG_DEBUG};
+    __android_log_write(priorities[level], LOG_TAG, text);
+#else
+    static const char* prefixes[] = {"", "E", "W", "I", "D"};
+    fprintf(stderr, "%s/%s: %s\n", prefixes[level], LOG_TAG, text);
+#endif
+}
+
+// Bounded multi-producer queue (Vyukov): each slot's sequence says whether
+// it is free for the writer at that position or holds a message for the
+// reader, so producers only contend on one fetch of the write position.
+const int LOG_RING_SIZE = 256;
+const int LOG_MESSAGE_SIZE = 128;
+
+struct LogSlot {
+    atomic<size_t> sequence;
+    int level;
+    char text[LOG_MESSAGE_SIZE];
+};
+
+struct LogRing {
+    LogSlot slots[LOG_RING_SIZE];
+    atomic<size_t> writePosition{0};
+    atomic<size_t> readPosition{0};
+    atomic<uint64_t> dropped{0};
+    mutex readLock;
+
+    LogRing() {
+        for (size_t i = 0; i < LOG_RING_SIZE; i++) {
+            slots[i].sequence.store(i, memory_order_relaxed);
+        }
+    }
+};
+
+static LogRing& logRing() {
+    static LogRing ring;
+    return ring;
+}
+
+static void enqueue(int level, const char* format, va_list args) {
+    LogRing& ring = logRing();
+    size_t position = ring.writePosition.load(memory_order_relaxed);
+    LogSlot* slot;
+    while (true) {
+        slot = &ring.slots[position % LOG_RING_SIZE];
+        size_t sequence = slot->sequence.load(memory_order_acquire);
+        intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+        if (difference == 0) {
+            if (ring.writePosition.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (difference < 0) {
+            ring.dropped.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        else {
+            position = ring.writePosition.load(memory_order_relaxed);
+        }
+    }
+
+    vsnprintf(slot->text, LOG_MESSAGE_SIZE, format, args);
+    slot->level = level;
+    slot->sequence.store(position + 1, memory_order_release);
+}
+
+void match3Log(int level, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (level <= MATCH3_LOG_LEVEL_WARN) {
+        char text[LOG_MESSAGE_SIZE];
+        vsnprintf(text, sizeof(text), format, args);
+        writeLine(level, text);
+    }
+    else {
+        enqueue(level, format, args);
+    }
+    va_end(args);
+}
+
+int flushLogBuffer() {
+    LogRing& ring = logRing();
+    // One reader at a time; writers never wait for it.
+    lock_guard<mutex> guard(ring.readLock);
+    int flushed = 0;
+    size_t position = ring.readPosition.load(memory_order_relaxed);
+    while (true) {
+        LogSlot& slot = ring.slots[position % LOG_RING_SIZE];
+        if (slot.sequence.load(memory_order_acquire) != position + 1) {
+            break;
+        }
+        writeLine(slot.level, slot.text);
+        slot.sequence.store(position + LOG_RING_SIZE, memory_order_release);
+        position++;
+        flushed++;
+    }
+    ring.readPosition.store(position, memory_order_relaxed);
+    return flushed;
+}
+
+uint64_t droppedLogCount() {
+    return logRing().dropped.load(memory_order_relaxed);
+}
+
+static mutex flusherLock;
+static thread flusherThread;
+static atomic<bool> flusherRunning{false};
+
+void startLogFlusher(int intervalMs) {
+    lock_guard<mutex> guard(flusherLock);
+    if (flusherRunning.exchange(true)) {
+        return;
+    }
+    flusherThread = thread([intervalMs]() {
+        while (flusherRunning.load(memory_order_relaxed)) {
+            flushLogBuffer();
+            this_thread::sleep_for(chrono::milliseconds(intervalMs));
+        }
+        flushLogBuffer();
+    });
+}
+
+bool stopLogFlusher() {
+    lock_guard<mutex> guard(flusherLock);
+    if (!flusherRunning.exchange(false)) {
+        return false;
+    }
+    flusherThread.join();
+    return true;
+}
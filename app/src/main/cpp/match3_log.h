@@ -0,0 +1,65 @@
+#ifndef MATCH3ENGINE_MATCH3_LOG_H
+#define MATCH3ENGINE_MATCH3_LOG_H
+
+#include <cstdint>
+
+// Engine logging with a compile-time level. Calls above MATCH3_LOG_LEVEL
+// expand to nothing, arguments included, so they cost nothing in hot loops.
+//
+// ERROR and WARN are written straight to the platform log. INFO and DEBUG
+// are formatted into a lock-free ring buffer and written out by
+// flushLogBuffer(), called from any thread or by the flusher thread
+// (startLogFlusher()), never by the game thread on its own. When the ring
+// is full, messages are dropped and counted.
+//
+// In the app, the JNI layer owns the ring: JNI_OnLoad starts the flusher
+// when INFO or DEBUG is compiled in, JNI_OnUnload stops it, and Java can
+// drain it on demand (e.g. before a crash report) with nativeFlushLog.
+#define MATCH3_LOG_LEVEL_NONE 0
+#define MATCH3_LOG_LEVEL_ERROR 1
+#define MATCH3_LOG_LEVEL_WARN 2
+#define MATCH3_LOG_LEVEL_INFO 3
+#define MATCH3_LOG_LEVEL_DEBUG 4
+
+#ifndef MATCH3_LOG_LEVEL
+#ifdef NDEBUG
+#define MATCH3_LOG_LEVEL MATCH3_LOG_LEVEL_WARN
+#else
+#define MATCH3_LOG_LEVEL MATCH3_LOG_LEVEL_INFO
+#endif
+#endif
+
+void match3Log(int level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+// Writes out everything queued so far. Returns the number of messages.
+int flushLogBuffer();
+uint64_t droppedLogCount();
+// Background thread that flushes the ring every `intervalMs`.
+void startLogFlusher(int intervalMs = 50);
+// Returns whether a flusher was running.
+bool stopLogFlusher();
+
+#if MATCH3_LOG_LEVEL >= MATCH3_LOG_LEVEL_ERROR
+#define MATCH3_LOGE(...) match3Log(MATCH3_LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define MATCH3_LOGE(...) ((void)0)
+#endif
+
+#if MATCH3_LOG_LEVEL >= MATCH3_LOG_LEVEL_WARN
+#define MATCH3_LOGW(...) match3Log(MATCH3_LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define MATCH3_LOGW(...) ((void)0)
+#endif
+
+#if MATCH3_LOG_LEVEL >= MATCH3_LOG_LEVEL_INFO
+#define MATCH3_LOGI(...) match3Log(MATCH3_LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define MATCH3_LOGI(...) ((void)0)
+#endif
+
+#if MATCH3_LOG_LEVEL >= MATCH3_LOG_LEVEL_DEBUG
+#define MATCH3_LOGD(...) match3Log(MATCH3_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define MATCH3_LOGD(...) ((void)0)
+#endif
+
+#endif //MATCH3ENGINE_MATCH3_LOG_H
@@ -0,0 +1,102 @@
+#ifndef MATCH3ENGINE_MATCH3_RANDOM_H
+#define MATCH3ENGINE_MATCH3_RANDOM_H
+
+#include <cstdint>
+
+// Saved generator position; restoring it replays the same sequence.
+struct RandomState {
+    uint64_t state;
+    uint64_t increment;
+};
+
+// PCG32 (pcg-random.org): 64-bit LCG state with a permuted 32-bit output.
+// 16 bytes of state, and each odd increment selects an independent stream,
+// so parallel simulations can share a seed and still not overlap.
+class Match3Random {
+public:
+    using result_type = uint32_t;
+
+    Match3Random() {
+        setSeed(0);
+    }
+
+    explicit Match3Random(uint64_t seed, uint64_t stream = 0) {
+        setSeed(seed, stream);
+    }
+
+    void setSeed(uint64_t seed, uint64_t stream = 0) {
+        state = 0;
+        increment = (stream << 1) | 1;
+        next();
+        state += seed;
+        next();
+    }
+
+    uint32_t next() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + increment;
+        uint32_t shifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+        uint32_t rotation = static_cast<uint32_t>(old >> 59);
+        return (shifted >> rotation) | (shifted << ((32 - rotation) & 31));
+    }
+
+    // Uniform in [0, bound), without modulo bias (Lemire's multiply-shift).
+    int nextInt(int bound) {
+        uint32_t range = static_cast<uint32_t>(bound);
+        uint64_t product = uint64_t(next()) * range;
+        uint32_t low = static_cast<uint32_t>(product);
+        if (low < range) {
+            uint32_t threshold = -range % range;
+            while (low < threshold) {
+                product = uint64_t(next()) * range;
+                low = static_cast<uint32_t>(product);
+            }
+        }
+        return static_cast<int>(product >> 32);
+    }
+
+    // Same seed, different stream: reproducible and independent of the
+    // parent, e.g. one stream per simulation thread or rollout.
+    Match3Random stream(uint64_t streamId) const {
+        Match3Random child;
+        child.state = state;
+        child.increment = (streamId << 1) | 1;
+        child.next();
+        return child;
+    }
+
+    // A fresh generator seeded from this one's output.
+    Match3Random split() {
+        uint64_t seed = (uint64_t(next()) << 32) | next();
+        uint64_t streamId = (uint64_t(next()) << 32) | next();
+        return Match3Random(seed, streamId);
+    }
+
+    RandomState getState() const {
+        return {state, increment};
+    }
+
+    void setState(const RandomState& saved) {
+        state = saved.state;
+        increment = saved.increment | 1;
+    }
+
+    // UniformRandomBitGenerator, for use with <algorithm>/<random>.
+    static constexpr result_type min() {
+        return 0;
+    }
+
+    static constexpr result_type max() {
+        return UINT32_MAX;
+    }
+
+    result_type operator()() {
+        return next();
+    }
+
+private:
+    uint64_t state;
+    uint64_t increment;
+};
+
+#endif //MATCH3ENGINE_MATCH3_RANDOM_H
@@ -0,0 +1,135 @@
+#include "match3_search.h"
+#include <algorithm>
+#include <chrono>
+#include "match3_events.h"
+using namespace std;
+
+struct RolloutResult {
+    int cleared = 0;
+    int specials = 0;
+    int depth = 0;
+    bool finished = false;
+};
+
+// Totals from a swapAndResolve() event stream (see match3_events.h). A
+// truncated stream is summed as far as it goes.
+static RolloutResult summarizeEvents(const int32_t* events, int length) {
+    RolloutResult result;
+    int position = 0;
+    while (position < length) {
+        EventType type = static_cast<EventType>(events[position]);
+        int32_t first = position + 1 < length ? events[position + 1] : 0;
+        int32_t second = position + 2 < length ? events[position + 2] : 0;
+        switch (type) {
+            case EventType::SWAP:
+                position += 5;
+                break;
+            case EventType::STEP:
+                result.depth = max(result.depth, static_cast<int>(first));
+                position += 2;
+                break;
+            case EventType::MATCHED:
+                result.cleared += first;
+                position += 2 + 2 * first;
+                break;
+            case EventType::SPECIAL:
+                result.specials++;
+                position += 5;
+                break;
+            case EventType::ACTIVATED: {
+                int32_t count = position + 4 < length ? events[position + 4] : 0;
+                result.cleared += count;
+                position += 5 + 2 * count;
+                break;
+            }
+            case EventType::FALLS:
+                position += 3 + 2 * second;
+                break;
+            case EventType::REFILLED:
+                position += 2 + 3 * first;
+                break;
+            default:
+                position = length;
+                break;
+        }
+    }
+    result.finished = true;
+    return result;
+}
+
+vector<MoveScore> findBestMove(const Match3Engine& engine, WorkStealingPool& pool, const BestMoveOptions& options) {
+    using Clock = chrono::steady_clock;
+    const vector<Move> moves = engine.findValidMoves();
+    const int moveCount = static_cast<int>(moves.size());
+    const int rollouts = max(1, options.rollouts);
+    const bool limited = options.budgetMicros > 0;
+    const Clock::time_point deadline = Clock::now() + chrono::microseconds(options.budgetMicros);
+
+    // One engine and event buffer per worker, overwritten by each rollout,
+    // so steady-state rollouts reuse their storage instead of allocating.
+    vector<Match3Engine> scratch(pool.size(), engine);
+    vector<vector<int32_t>> eventBuffers(pool.size());
+    vector<RolloutResult> results(size_t(moveCount) * rollouts);
+
+    // Task i is rollout i / moveCount of move i % moveCount, so under a
+    // budget every move gets its first rollout before any gets a second.
+    pool.parallelFor(moveCount * rollouts, [&](int index, int worker) {
+        if (limited && Clock::now() >= deadline) {
+            return;
+        }
+        const Move& move = moves[index % moveCount];
+        Match3Engine& copy = scratch[worker];
+        vector<int32_t>& events = eventBuffers[worker];
+        if (events.empty()) {
+            events.resize(4096);
+        }
+        // A stream that did not fit is replayed into a buffer of its full
+        // length (the rollout is deterministic), so no rollout is scored
+        // from a prefix, whichever worker runs it.
+        int length;
+        while (true) {
+            copy = engine;
+            copy.setSeed(options.seed, index / moveCount);
+            length = copy.swapAndResolve(move.row1, move.col1, move.row2, move.col2,
+                                         events.data(), static_cast<int>(events.size()));
+            if (length <= static_cast<int>(events.size())) {
+                break;
+            }
+            events.resize(length);
+        }
+        results[index] = summarizeEvents(events.data(), length);
+    });
+
+    vector<MoveScore> scores;
+    scores.reserve(moveCount);
+    for (int moveIndex = 0; moveIndex < moveCount; moveIndex++) {
+        MoveScore score = {moves[moveIndex], 0, 0, 0, 0, 0};
+        for (int rollout = 0; rollout < rollouts; rollout++) {
+            const RolloutResult& result = results[size_t(rollout) * moveCount + moveIndex];
+            if (!result.finished) {
+                continue;
+            }
+            score.cleared += result.cleared;
+            score.specials += result.specials;
+            score.depth += result.depth;
+            score.rollouts++;
+        }
+        if (score.rollouts > 0) {
+            score.cleared /= score.rollouts;
+            score.specials /= score.rollouts;
+            score.depth /= score.rollouts;
+            score.score = options.clearedWeight * score.cleared + options.specialWeight * score.specials +
+                          options.depthWeight * score.depth;
+        }
+        scores.push_back(score);
+    }
+
+    // Ties keep scan order, so the ranking is stable across runs.
+    stable_sort(scores.begin(), scores.end(), [](const MoveScore& a, const MoveScore& b) {
+        if ((a.rollouts > 0) != (b.rollouts > 0)) {
+            return a.rollouts > 0;
+        }
+        return a.score > b.score;
+    });
+    return scores;
+}
@@ -0,0 +1,42 @@
+#ifndef MATCH3ENGINE_MATCH3_SEARCH_H
+#define MATCH3ENGINE_MATCH3_SEARCH_H
+
+#include <cstdint>
+#include <vector>
+#include "match3_engine.h"
+#include "match3_thread_pool.h"
+using namespace std;
+
+struct BestMoveOptions {
+    // Randomized rollouts per candidate move. Rollout r of every move uses
+    // the same refill stream (seed, r), so moves are compared on equal luck.
+    int rollouts = 16;
+    // Wall-clock limit for the whole search; 0 means none. Rollouts not yet
+    // started when it runs out are skipped.
+    int64_t budgetMicros = 0;
+    uint64_t seed = 0;
+    // score = clearedWeight * cells cleared + specialWeight * specials
+    //         created + depthWeight * cascade steps, averaged over rollouts.
+    double clearedWeight = 1.0;
+    double specialWeight = 5.0;
+    double depthWeight = 2.0;
+};
+
+struct MoveScore {
+    Move move;
+    double score;
+    // Means over the finished rollouts.
+    double cleared;
+    double specials;
+    double depth;
+    int rollouts;
+};
+
+// Plays every valid swap `options.rollouts` times on copies of `engine`
+// (swap, cascade with specials, random refills) across `pool`, and returns
+// the moves best first. Moves whose rollouts all missed the budget come
+// last with `rollouts` 0. The engine itself is not changed.
+vector<MoveScore> findBestMove(const Match3Engine& engine, WorkStealingPool& pool,
+                               const BestMoveOptions& options = BestMoveOptions());
+
+#endif //MATCH3ENGINE_MATCH3_SEARCH_H
@@ -0,0 +1,79 @@
+#include "match3_sessions.h"
+#include <atomic>
+#include <mutex>
+using namespace std;
+
+struct SessionSlot {
+    atomic<Match3Session*> session{nullptr};
+    // Last generation handed out for this slot. Written under the lock,
+    // before the session it belongs to is published.
+    atomic<uint32_t> generation{0};
+};
+
+static SessionSlot sessionSlots[MAX_SESSIONS];
+static mutex registryLock;
+static atomic<int> liveSessions{0};
+
+static SessionHandle packHandle(int index, uint32_t generation) {
+    return (SessionHandle(generation) << 32) | uint32_t(index);
+}
+
+SessionHandle createSession(int width, int height, int itemTypes, uint64_t seed) {
+    if (width <= 0 || height <= 0 || itemTypes <= 0) {
+        return 0;
+    }
+    lock_guard<mutex> guard(registryLock);
+    for (int index = 0; index < MAX_SESSIONS; index++) {
+        SessionSlot& slot = sessionSlots[index];
+        if (slot.session.load(memory_order_relaxed) != nullptr) {
+            continue;
+        }
+        // Generation 0 is skipped so no handle is ever 0.
+        uint32_t generation = slot.generation.load(memory_order_relaxed) + 1;
+        if (generation == 0) {
+            generation = 1;
+        }
+        Match3Session* session = new Match3Session(width, height, itemTypes, seed);
+        slot.generation.store(generation, memory_order_release);
+        slot.session.store(session, memory_order_release);
+        liveSessions.fetch_add(1, memory_order_relaxed);
+        return packHandle(index, generation);
+    }
+    return 0;
+}
+
+Match3Session* findSession(SessionHandle handle) {
+    uint32_t index = uint32_t(handle);
+    if (index >= uint32_t(MAX_SESSIONS)) {
+        return nullptr;
+    }
+    // The generation is bumped before a new session is published, so a
+    // pointer read between two matching generation reads belongs to the
+    // handle's own session.
+    const SessionSlot& slot = sessionSlots[index];
+    uint32_t generation = uint32_t(handle >> 32);
+    if (slot.generation.load(memory_order_acquire) != generation) {
+        return nullptr;
+    }
+    Match3Session* session = slot.session.load(memory_order_acquire);
+    if (session == nullptr || slot.generation.load(memory_order_acquire) != generation) {
+        return nullptr;
+    }
+    return session;
+}
+
+bool destroySession(SessionHandle handle) {
+    lock_guard<mutex> guard(registryLock);
+    Match3Session* session = findSession(handle);
+    if (session == nullptr) {
+        return false;
+    }
+    sessionSlots[uint32_t(handle)].session.store(nullptr, memory_order_release);
+    liveSessions.fetch_sub(1, memory_order_relaxed);
+    delete session;
+    return true;
+}
+
+int sessionCount() {
+    return liveSessions.load(memory_order_relaxed);
+}
@@ -0,0 +1,45 @@
+#ifndef MATCH3ENGINE_MATCH3_SESSIONS_H
+#define MATCH3ENGINE_MATCH3_SESSIONS_H
+
+#include <cstdint>
+#include "match3_engine.h"
+
+// Caller memory (e.g. a direct ByteBuffer) a session writes output into.
+// Capacity is in ints. `owner` is an opaque reference (a JNI global ref)
+// the caller holds so the memory outlives its use here.
+struct OutputBuffer {
+    int32_t* data = nullptr;
+    int capacity = 0;
+    void* owner = nullptr;
+};
+
+// One board and its output buffers. A session is used by one thread at a
+// time; different sessions can be used in parallel.
+struct Match3Session {
+    Match3Engine engine;
+    OutputBuffer matchBuffer;
+    OutputBuffer changedBuffer;
+    OutputBuffer eventBuffer;
+    // Owner of the board memory while the engine has one attached.
+    void* boardOwner = nullptr;
+
+    Match3Session(int width, int height, int itemTypes, uint64_t seed):
+        engine(width, height, itemTypes, seed) {}
+};
+
+// A handle packs a registry slot with that slot's generation, so a handle
+// to a destroyed session never resolves to a later one. 0 is never valid.
+using SessionHandle = int64_t;
+
+const int MAX_SESSIONS = 4096;
+
+// Create and destroy take a lock; findSession() is lock-free and checks the
+// handle against the slot, never the session, so a stale handle can be
+// looked up while its slot is destroyed and reused. Destroying a session
+// while another thread is still using it is not allowed.
+SessionHandle createSession(int width, int height, int itemTypes, uint64_t seed);
+bool destroySession(SessionHandle handle);
+Match3Session* findSession(SessionHandle handle);
+int sessionCount();
+
+#endif //MATCH3ENGINE_MATCH3_SESSIONS_H
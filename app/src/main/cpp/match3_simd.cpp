@@ -0,0 +1,143 @@
+#include "match3_simd.h"
+#include <atomic>
+using namespace std;
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define MATCH3_SIMD_X86 1
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__)
+#define MATCH3_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Each kernel handles [from, count) so a wider kernel can hand its tail to a
+// narrower one without shifting the bit positions in `starts`.
+static void runStartsScalar(const int8_t* a, const int8_t* b, const int8_t* c, int from, int count, uint64_t* starts) {
+    for (int i = from; i < count; i++) {
+        if (a[i] >= 0 && a[i] == b[i] && b[i] == c[i]) {
+            starts[i / 64] |= uint64_t(1) << (i % 64);
+        }
+    }
+}
+
+#ifdef MATCH3_SIMD_X86
+__attribute__((target("sse2")))
+static void runStartsSse2(const int8_t* a, const int8_t* b, const int8_t* c, int from, int count, uint64_t* starts) {
+    const __m128i zero = _mm_setzero_si128();
+    int i = from;
+    for (; i + 16 <= count; i += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        __m128i vc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c + i));
+        __m128i same = _mm_and_si128(_mm_cmpeq_epi8(va, vb), _mm_cmpeq_epi8(vb, vc));
+        same = _mm_andnot_si128(_mm_cmplt_epi8(va, zero), same);
+        uint64_t bits = static_cast<uint32_t>(_mm_movemask_epi8(same));
+        starts[i / 64] |= bits << (i % 64);
+    }
+    runStartsScalar(a, b, c, i, count, starts);
+}
+
+__attribute__((target("avx2")))
+static void runStartsAvx2(const int8_t* a, const int8_t* b, const int8_t* c, int from, int count, uint64_t* starts) {
+    const __m256i zero = _mm256_setzero_si256();
+    int i = from;
+    for (; i + 32 <= count; i += 32) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        __m256i vc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c + i));
+        __m256i same = _mm256_and_si256(_mm256_cmpeq_epi8(va, vb), _mm256_cmpeq_epi8(vb, vc));
+        same = _mm256_andnot_si256(_mm256_cmpgt_epi8(zero, va), same);
+        uint64_t bits = static_cast<uint32_t>(_mm256_movemask_epi8(same));
+        starts[i / 64] |= bits << (i % 64);
+    }
+    runStartsSse2(a, b, c, i, count, starts);
+}
+#endif
+
+#ifdef MATCH3_SIMD_NEON
+static void runStartsNeon(const int8_t* a, const int8_t* b, const int8_t* c, int from, int count, uint64_t* starts) {
+    static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    const uint8x16_t bitWeights = vld1q_u8(weights);
+    const int8x16_t zero = vdupq_n_s8(0);
+    int i = from;
+    for (; i + 16 <= count; i += 16) {
+        int8x16_t va = vld1q_s8(a + i);
+        int8x16_t vb = vld1q_s8(b + i);
+        int8x16_t vc = vld1q_s8(c + i);
+        uint8x16_t same = vandq_u8(vceqq_s8(va, vb), vceqq_s8(vb, vc));
+        same = vandq_u8(same, vcgeq_s8(va, zero));
+        same = vandq_u8(same, bitWeights);
+        uint64_t bits = vaddv_u8(vget_low_u8(same)) | (uint64_t(vaddv_u8(vget_high_u8(same))) << 8);
+        starts[i / 64] |= bits << (i % 64);
+    }
+    runStartsScalar(a, b, c, i, count, starts);
+}
+#endif
+
+template<void (*RunStarts)(const int8_t*, const int8_t*, const int8_t*, int, int, uint64_t*)>
+static void runStartsFromZero(const int8_t* a, const int8_t* b, const int8_t* c, int count, uint64_t* starts) {
+    RunStarts(a, b, c, 0, count, starts);
+}
+
+static const SimdKernels SCALAR_KERNELS = {SimdLevel::SCALAR, runStartsFromZero<runStartsScalar>};
+#ifdef MATCH3_SIMD_X86
+static const SimdKernels SSE2_KERNELS = {SimdLevel::SSE2, runStartsFromZero<runStartsSse2>};
+static const SimdKernels AVX2_KERNELS = {SimdLevel::AVX2, runStartsFromZero<runStartsAvx2>};
+#endif
+#ifdef MATCH3_SIMD_NEON
+static const SimdKernels NEON_KERNELS = {SimdLevel::NEON, runStartsFromZero<runStartsNeon>};
+#endif
+
+static const SimdKernels* kernelsFor(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::SCALAR:
+            return &SCALAR_KERNELS;
+#ifdef MATCH3_SIMD_X86
+        case SimdLevel::SSE2:
+            return __builtin_cpu_supports("sse2") ? &SSE2_KERNELS : nullptr;
+        case SimdLevel::AVX2:
+            return __builtin_cpu_supports("avx2") ? &AVX2_KERNELS : nullptr;
+#endif
+#ifdef MATCH3_SIMD_NEON
+        case SimdLevel::NEON:
+            return &NEON_KERNELS;
+#endif
+        default:
+            return nullptr;
+    }
+}
+
+static const SimdKernels* bestKernels() {
+    const SimdLevel preferred[] = {SimdLevel::AVX2, SimdLevel::SSE2, SimdLevel::NEON};
+    for (SimdLevel level: preferred) {
+        if (const SimdKernels* kernels = kernelsFor(level)) {
+            return kernels;
+        }
+    }
+    return &SCALAR_KERNELS;
+}
+
+static atomic<const SimdKernels*> activeKernels{nullptr};
+
+const SimdKernels& simdKernels() {
+    const SimdKernels* kernels = activeKernels.load(memory_order_acquire);
+    if (kernels == nullptr) {
+        kernels = bestKernels();
+        activeKernels.store(kernels, memory_order_release);
+    }
+    return *kernels;
+}
+
+bool isSimdLevelSupported(SimdLevel level) {
+    return kernelsFor(level) != nullptr;
+}
+
+bool selectSimdKernels(SimdLevel level) {
+    const SimdKernels* kernels = kernelsFor(level);
+    if (kernels == nullptr) {
+        return false;
+    }
+    activeKernels.store(kernels, memory_order_release);
+    return true;
+}
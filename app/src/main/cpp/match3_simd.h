@@ -0,0 +1,29 @@
+#ifndef MATCH3ENGINE_MATCH3_SIMD_H
+#define MATCH3ENGINE_MATCH3_SIMD_H
+
+#include <cstdint>
+
+enum class SimdLevel {
+    SCALAR,
+    SSE2,
+    AVX2,
+    NEON
+};
+
+// Kernels over byte planes of item types (one int8_t per cell, negative means
+// empty). Used for boards wider than one bitboard word.
+struct SimdKernels {
+    SimdLevel level;
+
+    // Sets bit i of `starts` (64 bits per word) wherever a[i] == b[i] == c[i]
+    // and the type is not empty, i.e. where a run of three starts.
+    void (*runStarts)(const int8_t* a, const int8_t* b, const int8_t* c, int count, uint64_t* starts);
+};
+
+// Kernels for the best level this CPU supports, chosen on first use.
+const SimdKernels& simdKernels();
+bool isSimdLevelSupported(SimdLevel level);
+// Forces a specific level (e.g. SCALAR in tests). Returns false if unsupported.
+bool selectSimdKernels(SimdLevel level);
+
+#endif //MATCH3ENGINE_MATCH3_SIMD_H
@@ -0,0 +1,74 @@
+#ifndef MATCH3ENGINE_MATCH3_STATS_H
+#define MATCH3ENGINE_MATCH3_STATS_H
+
+#include <cstdint>
+
+// Hot-path instrumentation, compiled in only with MATCH3_ENABLE_STATS
+// (CMake option of the same name). Without it the macros below expand to
+// nothing and EngineStats stays zeroed with `enabled` false.
+
+enum class StatPhase {
+    DETECTION,   // run detection (findMatchMask)
+    PATTERNS,    // classifying runs into patterns
+    SPECIALS,    // spawning and firing specials
+    GRAVITY,
+    REFILL,      // includes the minimum-moves check, which scans moves
+    MOVE_SCAN,   // valid-move index rebuilds and rechecks
+    SHUFFLE,
+    COUNT
+};
+
+const int STAT_PHASE_COUNT = static_cast<int>(StatPhase::COUNT);
+// Cascade depths 0..14 get their own bucket; the last one collects 15+.
+const int CASCADE_DEPTH_BUCKETS = 16;
+
+struct PhaseStats {
+    uint64_t calls;
+    uint64_t nanos;
+};
+
+struct EngineStats {
+    bool enabled;
+    PhaseStats phases[STAT_PHASE_COUNT];
+    // Steps per processCascade()/processCascadeWithSpecials() call.
+    uint64_t cascadeDepths[CASCADE_DEPTH_BUCKETS];
+    uint64_t refillCells;
+    // Cells where every colour completed a run, so any colour was taken.
+    uint64_t refillFallbacks;
+    // Redraw passes made to reach the minimum valid moves after a refill.
+    uint64_t refillRedraws;
+    uint64_t shuffleCalls;
+    uint64_t shuffleAttempts;
+    uint64_t shuffleFailures;
+};
+
+#ifdef MATCH3_ENABLE_STATS
+#include <chrono>
+
+// Adds one call and the scope's wall time to a phase.
+class PhaseTimer {
+public:
+    explicit PhaseTimer(PhaseStats& phase): phase(phase), start(std::chrono::steady_clock::now()) {}
+
+    ~PhaseTimer() {
+        phase.calls++;
+        phase.nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    PhaseStats& phase;
+    std::chrono::steady_clock::time_point start;
+};
+
+#define MATCH3_TIME_PHASE(phase) PhaseTimer phaseTimer(stats.phases[static_cast<int>(phase)])
+#define MATCH3_COUNT(field, amount) (stats.field += (amount))
+#define MATCH3_RECORD_CASCADE(depth) \
+    (stats.cascadeDepths[(depth) < CASCADE_DEPTH_BUCKETS ? (depth) : CASCADE_DEPTH_BUCKETS - 1]++)
+#else
+#define MATCH3_TIME_PHASE(phase) ((void)0)
+#define MATCH3_COUNT(field, amount) ((void)0)
+#define MATCH3_RECORD_CASCADE(depth) ((void)0)
+#endif
+
+#endif //MATCH3ENGINE_MATCH3_STATS_H
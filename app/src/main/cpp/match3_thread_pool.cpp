@@ -0,0 +1,114 @@
+#include "match3_thread_pool.h"
+#include <algorithm>
+using namespace std;
+
+WorkStealingPool::WorkStealingPool(int threads) {
+    if (threads <= 0) {
+        threads = max(1, static_cast<int>(thread::hardware_concurrency()));
+    }
+    for (int worker = 0; worker < threads; worker++) {
+        ranges.push_back(make_unique<WorkRange>());
+    }
+    for (int worker = 1; worker < threads; worker++) {
+        this->threads.emplace_back(&WorkStealingPool::workerLoop, this, worker);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        lock_guard<mutex> guard(stateLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (thread& worker: threads) {
+        worker.join();
+    }
+}
+
+void WorkStealingPool::parallelFor(int count, const function<void(int, int)>& task) {
+    if (count <= 0) {
+        return;
+    }
+    lock_guard<mutex> loop(loopLock);
+    const int workers = size();
+    for (int worker = 0; worker < workers; worker++) {
+        WorkRange& range = *ranges[worker];
+        lock_guard<mutex> guard(range.lock);
+        range.next = static_cast<int>(int64_t(count) * worker / workers);
+        range.end = static_cast<int>(int64_t(count) * (worker + 1) / workers);
+    }
+
+    {
+        lock_guard<mutex> guard(stateLock);
+        currentTask = &task;
+        busyWorkers = workers - 1;
+        generation++;
+    }
+    wake.notify_all();
+    runTasks(0);
+
+    // A worker only leaves runTasks() once every range is empty, so when the
+    // last one has left, every task has finished.
+    unique_lock<mutex> guard(stateLock);
+    done.wait(guard, [this]() { return busyWorkers == 0; });
+    currentTask = nullptr;
+}
+
+bool WorkStealingPool::takeTask(int worker, int& index) {
+    const int workers = size();
+    WorkRange& own = *ranges[worker];
+    {
+        lock_guard<mutex> guard(own.lock);
+        if (own.next < own.end) {
+            index = own.next++;
+            return true;
+        }
+    }
+    for (int offset = 1; offset < workers; offset++) {
+        int stolenBegin;
+        int stolenEnd;
+        {
+            WorkRange& victim = *ranges[(worker + offset) % workers];
+            lock_guard<mutex> guard(victim.lock);
+            int left = victim.end - victim.next;
+            if (left <= 0) {
+                continue;
+            }
+            stolenBegin = victim.next + left / 2;
+            stolenEnd = victim.end;
+            victim.end = stolenBegin;
+        }
+        lock_guard<mutex> guard(own.lock);
+        index = stolenBegin;
+        own.next = stolenBegin + 1;
+        own.end = stolenEnd;
+        return true;
+    }
+    return false;
+}
+
+void WorkStealingPool::runTasks(int worker) {
+    int index;
+    while (takeTask(worker, index)) {
+        (*currentTask)(index, worker);
+    }
+}
+
+void WorkStealingPool::workerLoop(int worker) {
+    uint64_t seen = 0;
+    while (true) {
+        {
+            unique_lock<mutex> guard(stateLock);
+            wake.wait(guard, [&]() { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+        }
+        runTasks(worker);
+        lock_guard<mutex> guard(stateLock);
+        if (--busyWorkers == 0) {
+            done.notify_one();
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef MATCH3ENGINE_MATCH3_THREAD_POOL_H
+#define MATCH3ENGINE_MATCH3_THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// Fixed set of worker threads for fork-join loops. parallelFor() deals the
+// indices out as one contiguous range per worker; a worker takes indices
+// from the front of its own range and, once it is empty, steals the back
+// half of another's, so uneven tasks (long cascades) still keep every core
+// busy. Handing out a loop costs O(workers), however many indices it has.
+// The calling thread works too, as worker 0, so a pool with no extra
+// threads simply runs the loop inline.
+class WorkStealingPool {
+public:
+    // `threads` counts the caller; 0 means one per hardware thread.
+    explicit WorkStealingPool(int threads = 0);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Number of workers, including the caller.
+    int size() const {
+        return static_cast<int>(ranges.size());
+    }
+
+    // Calls task(index, worker) for every index in [0, count) and returns
+    // once all have run. `worker` is in [0, size()), for per-worker scratch.
+    // One loop runs at a time; concurrent callers wait their turn.
+    void parallelFor(int count, const function<void(int index, int worker)>& task);
+
+private:
+    // Indices [next, end) not yet taken.
+    struct WorkRange {
+        mutex lock;
+        int next = 0;
+        int end = 0;
+    };
+
+    bool takeTask(int worker, int& index);
+    void runTasks(int worker);
+    void workerLoop(int worker);
+
+    vector<unique_ptr<WorkRange>> ranges;
+    vector<thread> threads;
+    mutex loopLock;
+    mutex stateLock;
+    condition_variable wake;
+    condition_variable done;
+    const function<void(int, int)>* currentTask = nullptr;
+    uint64_t generation = 0;
+    int busyWorkers = 0;
+    bool stopping = false;
+};
+
+#endif //MATCH3ENGINE_MATCH3_THREAD_POOL_H
@@ -0,0 +1,94 @@
+#ifndef MATCH3ENGINE_MATCH3_ZOBRIST_H
+#define MATCH3ENGINE_MATCH3_ZOBRIST_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+using namespace std;
+
+// Zobrist key of one cell holding (type, special): a fixed pseudo-random
+// 64-bit value per (cell index, type, special), and 0 for an empty cell. A
+// board's hash is the XOR of its cells' keys, so a write updates it with two
+// XORs. The keys come from mixing the feature (the splitmix64 finalizer)
+// instead of a random table, so any board size or colour count works with
+// no setup and no memory.
+inline uint64_t zobristKey(int cellIndex, int type, int special) {
+    if (type < 0 && special == 0) {
+        return 0;
+    }
+    uint64_t key = (uint64_t(uint32_t(cellIndex)) << 32) ^ (uint64_t(uint32_t(type + 1)) << 8) ^ uint64_t(special);
+    key += 0x9E3779B97F4A7C15ULL;
+    key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    key = (key ^ (key >> 27)) * 0x94D049BB133111EBULL;
+    return key ^ (key >> 31);
+}
+
+// Fixed-size hash -> 64-bit value table shared by any number of threads
+// without locks. Each slot keeps the value and hash ^ value; a reader only
+// accepts a slot whose two words agree with the hash it asked for, so a
+// slot torn by a concurrent store reads as a miss instead of a wrong value.
+// Stores always replace, so the table never fills up: it forgets.
+class TranspositionTable {
+public:
+    // Rounded up to a power of two, at least 1.
+    explicit TranspositionTable(size_t entries) {
+        capacity = 1;
+        while (capacity < entries) {
+            capacity <<= 1;
+        }
+        slots = make_unique<Slot[]>(capacity);
+    }
+
+    size_t size() const {
+        return capacity;
+    }
+
+    void store(uint64_t hash, uint64_t value) {
+        Slot& slot = slots[hash & (capacity - 1)];
+        slot.check.store(hash ^ value, memory_order_relaxed);
+        slot.value.store(value, memory_order_relaxed);
+    }
+
+    bool probe(uint64_t hash, uint64_t& value) const {
+        const Slot& slot = slots[hash & (capacity - 1)];
+        uint64_t stored = slot.value.load(memory_order_relaxed);
+        uint64_t check = slot.check.load(memory_order_relaxed);
+        // (0, 0) is a cleared slot, not hash 0 with value 0.
+        if ((check ^ stored) != hash || (check == 0 && stored == 0)) {
+            return false;
+        }
+        value = stored;
+        return true;
+    }
+
+    // Stores `hash` unless it is already there; returns true if it was
+    // new. For dedup, where the value does not matter. Two threads
+    // inserting the same new hash at once may both see it as new.
+    bool insert(uint64_t hash) {
+        uint64_t ignored;
+        if (probe(hash, ignored)) {
+            return false;
+        }
+        store(hash, 1);
+        return true;
+    }
+
+    void clear() {
+        for (size_t index = 0; index < capacity; index++) {
+            slots[index].check.store(0, memory_order_relaxed);
+            slots[index].value.store(0, memory_order_relaxed);
+        }
+    }
+
+private:
+    struct Slot {
+        atomic<uint64_t> check{0};
+        atomic<uint64_t> value{0};
+    };
+
+    size_t capacity;
+    unique_ptr<Slot[]> slots;
+};
+
+#endif //MATCH3ENGINE_MATCH3_ZOBRIST_H
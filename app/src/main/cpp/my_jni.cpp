@@ -1,39 +1,117 @@
 #include <jni.h>
-#include <set>
+#include <atomic>
+#include <random>
 #include <vector>
-#include "match3_engine.h"
+#include "match3_log.h"
+#include "match3_sessions.h"
 
-Match3Engine* engine = nullptr;
+// Sessions are addressed by handle (see match3_sessions.h). The handle-less
+// natives act on a default session created by nativeInit.
+static atomic<SessionHandle> defaultHandle{0};
 
+static Match3Session* defaultSession() {
+    return findSession(defaultHandle.load(memory_order_acquire));
+}
+
+// A session only keeps raw pointers into direct buffers, so it holds a
+// global reference to each buffer it uses to keep the Java object (and its
+// memory) from being collected, and drops it when it lets go of the buffer.
+static void releaseOwner(JNIEnv *env, void*& owner) {
+    if (owner != nullptr) {
+        env->DeleteGlobalRef(static_cast<jobject>(owner));
+        owner = nullptr;
+    }
+}
+
+static void releaseBuffers(JNIEnv *env, Match3Session* session) {
+    releaseOwner(env, session->matchBuffer.owner);
+    releaseOwner(env, session->changedBuffer.owner);
+    releaseOwner(env, session->eventBuffer.owner);
+    releaseOwner(env, session->boardOwner);
+}
+
+// Preallocated direct buffers (native byte order) the engine writes
+// per-frame output into. Replaces `output`, releasing its old buffer.
+static void setDirectInts(JNIEnv *env, OutputBuffer& output, jobject buffer) {
+    releaseOwner(env, output.owner);
+    output = OutputBuffer();
+    if (buffer == nullptr) {
+        return;
+    }
+    output.data = static_cast<int32_t*>(env->GetDirectBufferAddress(buffer));
+    jlong bytes = env->GetDirectBufferCapacity(buffer);
+    if (output.data != nullptr && bytes > 0) {
+        output.capacity = static_cast<int>(bytes / sizeof(jint));
+    }
+    if (output.data != nullptr) {
+        output.owner = env->NewGlobalRef(buffer);
+    }
+}
+
+// Creates the default session unless a live one exists. A handle left
+// behind by a destroyed default session is replaced, not waited on.
 void init(JNIEnv *env, jobject thiz,
           int width, int height, int itemTypes) {
-    if (engine == nullptr) {
-        engine = new Match3Engine(width, height, itemTypes);
+    SessionHandle expected = defaultHandle.load(memory_order_acquire);
+    if (findSession(expected) != nullptr) {
+        return;
+    }
+    SessionHandle handle = createSession(width, height, itemTypes, random_device{}());
+    if (!defaultHandle.compare_exchange_strong(expected, handle)) {
+        destroySession(handle);
     }
 }
 
-jintArray findAllMatches(JNIEnv *env, jobject thiz) {
-    if (!engine) {
+// Returns 0 when the registry is full or the sizes are invalid.
+jlong createSessionNative(JNIEnv *env, jobject thiz,
+                          jint width, jint height, jint itemTypes) {
+    return createSession(width, height, itemTypes, random_device{}());
+}
+
+jlong createSeededSession(JNIEnv *env, jobject thiz,
+                          jint width, jint height, jint itemTypes, jlong seed) {
+    return createSession(width, height, itemTypes, static_cast<uint64_t>(seed));
+}
+
+jboolean destroySessionNative(JNIEnv *env, jobject thiz, jlong handle) {
+    Match3Session* session = findSession(handle);
+    if (session != nullptr) {
+        releaseBuffers(env, session);
+    }
+    if (!destroySession(handle)) {
+        return JNI_FALSE;
+    }
+    // Destroying the default session lets the next nativeInit make one.
+    SessionHandle expected = handle;
+    defaultHandle.compare_exchange_strong(expected, 0);
+    return JNI_TRUE;
+}
+
+static jintArray findAllMatches(JNIEnv *env, Match3Session* session) {
+    if (!session) {
         return nullptr;
     }
-    set<pair<int, int>> allMatches = engine->findAllMatches();
-    int arraySize = allMatches.size() * 2;
+    BoardMask allMatches = session->engine.findMatchMask();
+    int arraySize = allMatches.count() * 2;
     jintArray result = env->NewIntArray(arraySize);
     if (result == nullptr) {
         return nullptr;
     }
     vector<jint> buffer;
     buffer.reserve(arraySize);
-    for (const auto &p: allMatches) {
-        buffer.push_back(p.first);
-        buffer.push_back(p.second);
-    }
+    allMatches.forEach([&](int row, int col) {
+        buffer.push_back(row);
+        buffer.push_back(col);
+    });
     env->SetIntArrayRegion(result, 0, arraySize, buffer.data());
     return result;
 }
 
-void setGrid(JNIEnv *env, jobject thiz,
-             jintArray flatData, jint rows, jint cols) {
+static void setGrid(JNIEnv *env, Match3Session* session,
+                    jintArray flatData, jint rows, jint cols) {
+    if (!session || flatData == nullptr) {
+        return;
+    }
     jint *data = env->GetIntArrayElements(flatData, nullptr);
     if (data == nullptr) {
         return;
@@ -49,15 +127,307 @@ void setGrid(JNIEnv *env, jobject thiz,
     }
 
     env->ReleaseIntArrayElements(flatData, data, JNI_ABORT);
-    engine->setGrid(grid);
+    session->engine.setGrid(grid);
+    // A grid of another shape detaches the board buffer; Java can tell
+    // from nativeIsBoardAttached().
+    if (!session->engine.isBoardAttached()) {
+        releaseOwner(env, session->boardOwner);
+    }
+}
+
+// The board lives in `board`, a native-order direct ByteBuffer of
+// rows * cols (type, special) int pairs that Java renders from directly.
+// The session keeps the buffer alive until it is detached or destroyed.
+static jboolean attachBoard(JNIEnv *env, Match3Session* session,
+                            jobject board, jint rows, jint cols) {
+    if (!session || board == nullptr) {
+        return JNI_FALSE;
+    }
+    void* address = env->GetDirectBufferAddress(board);
+    jlong bytes = env->GetDirectBufferCapacity(board);
+    if (address == nullptr || bytes < jlong(rows) * cols * jlong(sizeof(Cell))) {
+        return JNI_FALSE;
+    }
+    if (!session->engine.attachBoard(static_cast<Cell*>(address), cols, rows)) {
+        return JNI_FALSE;
+    }
+    releaseOwner(env, session->boardOwner);
+    session->boardOwner = env->NewGlobalRef(board);
+    return JNI_TRUE;
+}
+
+// Copies the board back into native memory and releases the buffer.
+static void detachBoard(JNIEnv *env, Match3Session* session) {
+    if (session) {
+        session->engine.detachBoard();
+        releaseOwner(env, session->boardOwner);
+    }
+}
+
+static jboolean isBoardAttached(Match3Session* session) {
+    return session && session->engine.isBoardAttached() ? JNI_TRUE : JNI_FALSE;
+}
+
+static void boardChanged(Match3Session* session) {
+    if (session) {
+        session->engine.boardChanged();
+    }
+}
+
+static void setOutputBuffers(JNIEnv *env, Match3Session* session,
+                             jobject matches, jobject changed) {
+    if (session) {
+        setDirectInts(env, session->matchBuffer, matches);
+        setDirectInts(env, session->changedBuffer, changed);
+    }
+}
+
+static void setEventBuffer(JNIEnv *env, Match3Session* session, jobject events) {
+    if (session) {
+        setDirectInts(env, session->eventBuffer, events);
+    }
+}
+
+// Return the number of cells found (which may exceed the buffer), or -1
+// when there is no session or buffer.
+static jint writeMatches(Match3Session* session) {
+    if (!session || session->matchBuffer.data == nullptr) {
+        return -1;
+    }
+    return session->engine.writeMatches(session->matchBuffer.data, session->matchBuffer.capacity / 2);
+}
+
+static jint writeChangedCells(Match3Session* session) {
+    if (!session || session->changedBuffer.data == nullptr) {
+        return -1;
+    }
+    return session->engine.writeChangedCells(session->changedBuffer.data, session->changedBuffer.capacity / 2);
+}
+
+// One call per move: the swap, the cascade and the spawned specials, as the
+// event stream from match3_events.h in the event buffer. Returns its length
+// (larger than the buffer if it did not fit), -1 for an invalid move, or -2
+// when there is no session or event buffer.
+static jint swapAndResolve(Match3Session* session,
+                           jint row1, jint col1, jint row2, jint col2) {
+    if (!session || session->eventBuffer.data == nullptr) {
+        return -2;
+    }
+    return session->engine.swapAndResolve(row1, col1, row2, col2,
+                                          session->eventBuffer.data, session->eventBuffer.capacity);
+}
+
+// Stats as a long[]: enabled (0/1), then calls and nanos for each
+// StatPhase, the cascade depth histogram, refillCells, refillFallbacks,
+// refillRedraws, shuffleCalls, shuffleAttempts and shuffleFailures.
+static jlongArray getStats(JNIEnv *env, Match3Session* session) {
+    if (!session) {
+        return nullptr;
+    }
+    EngineStats stats = session->engine.getStats();
+    vector<jlong> values;
+    values.push_back(stats.enabled ? 1 : 0);
+    for (const PhaseStats& phase: stats.phases) {
+        values.push_back(phase.calls);
+        values.push_back(phase.nanos);
+    }
+    for (uint64_t depth: stats.cascadeDepths) {
+        values.push_back(depth);
+    }
+    const uint64_t counters[] = {stats.refillCells, stats.refillFallbacks, stats.refillRedraws,
+                                 stats.shuffleCalls, stats.shuffleAttempts, stats.shuffleFailures};
+    for (uint64_t counter: counters) {
+        values.push_back(counter);
+    }
+
+    jlongArray result = env->NewLongArray(values.size());
+    if (result == nullptr) {
+        return nullptr;
+    }
+    env->SetLongArrayRegion(result, 0, values.size(), values.data());
+    return result;
+}
+
+static void resetStats(Match3Session* session) {
+    if (session) {
+        session->engine.resetStats();
+    }
+}
+
+// JNI entry points: the handle-less form acts on the default session, the
+// (J...) overload on the session behind the handle.
+jintArray findAllMatchesDefault(JNIEnv *env, jobject thiz) {
+    return findAllMatches(env, defaultSession());
+}
+
+jintArray findAllMatchesSession(JNIEnv *env, jobject thiz, jlong handle) {
+    return findAllMatches(env, findSession(handle));
+}
+
+void setGridDefault(JNIEnv *env, jobject thiz, jintArray flatData, jint rows, jint cols) {
+    setGrid(env, defaultSession(), flatData, rows, cols);
+}
+
+void setGridSession(JNIEnv *env, jobject thiz, jlong handle, jintArray flatData, jint rows, jint cols) {
+    setGrid(env, findSession(handle), flatData, rows, cols);
+}
+
+jboolean attachBoardDefault(JNIEnv *env, jobject thiz, jobject board, jint rows, jint cols) {
+    return attachBoard(env, defaultSession(), board, rows, cols);
+}
+
+jboolean attachBoardSession(JNIEnv *env, jobject thiz, jlong handle, jobject board, jint rows, jint cols) {
+    return attachBoard(env, findSession(handle), board, rows, cols);
+}
+
+void detachBoardDefault(JNIEnv *env, jobject thiz) {
+    detachBoard(env, defaultSession());
+}
+
+void detachBoardSession(JNIEnv *env, jobject thiz, jlong handle) {
+    detachBoard(env, findSession(handle));
+}
+
+jboolean isBoardAttachedDefault(JNIEnv *env, jobject thiz) {
+    return isBoardAttached(defaultSession());
+}
+
+jboolean isBoardAttachedSession(JNIEnv *env, jobject thiz, jlong handle) {
+    return isBoardAttached(findSession(handle));
+}
+
+void boardChangedDefault(JNIEnv *env, jobject thiz) {
+    boardChanged(defaultSession());
+}
+
+void boardChangedSession(JNIEnv *env, jobject thiz, jlong handle) {
+    boardChanged(findSession(handle));
+}
+
+void setOutputBuffersDefault(JNIEnv *env, jobject thiz, jobject matches, jobject changed) {
+    setOutputBuffers(env, defaultSession(), matches, changed);
+}
+
+void setOutputBuffersSession(JNIEnv *env, jobject thiz, jlong handle, jobject matches, jobject changed) {
+    setOutputBuffers(env, findSession(handle), matches, changed);
+}
+
+void setEventBufferDefault(JNIEnv *env, jobject thiz, jobject events) {
+    setEventBuffer(env, defaultSession(), events);
+}
+
+void setEventBufferSession(JNIEnv *env, jobject thiz, jlong handle, jobject events) {
+    setEventBuffer(env, findSession(handle), events);
+}
+
+jint writeMatchesDefault(JNIEnv *env, jobject thiz) {
+    return writeMatches(defaultSession());
+}
+
+jint writeMatchesSession(JNIEnv *env, jobject thiz, jlong handle) {
+    return writeMatches(findSession(handle));
+}
+
+jint writeChangedCellsDefault(JNIEnv *env, jobject thiz) {
+    return writeChangedCells(defaultSession());
+}
+
+jint writeChangedCellsSession(JNIEnv *env, jobject thiz, jlong handle) {
+    return writeChangedCells(findSession(handle));
+}
+
+jint swapAndResolveDefault(JNIEnv *env, jobject thiz, jint row1, jint col1, jint row2, jint col2) {
+    return swapAndResolve(defaultSession(), row1, col1, row2, col2);
+}
+
+jint swapAndResolveSession(JNIEnv *env, jobject thiz, jlong handle,
+                           jint row1, jint col1, jint row2, jint col2) {
+    return swapAndResolve(findSession(handle), row1, col1, row2, col2);
+}
+
+jlongArray getStatsDefault(JNIEnv *env, jobject thiz) {
+    return getStats(env, defaultSession());
+}
+
+jlongArray getStatsSession(JNIEnv *env, jobject thiz, jlong handle) {
+    return getStats(env, findSession(handle));
+}
+
+void resetStatsDefault(JNIEnv *env, jobject thiz) {
+    resetStats(defaultSession());
+}
+
+void resetStatsSession(JNIEnv *env, jobject thiz, jlong handle) {
+    resetStats(findSession(handle));
+}
+
+// Writes out the buffered INFO/DEBUG messages now. Returns how many.
+jint flushLog(JNIEnv *env, jobject thiz) {
+    return flushLogBuffer();
 }
 
 static JNINativeMethod method_table[] = {
         {"nativeInit", "(III)V", (void*)init},
 
-        {"nativeSetGrid", "([III)V", (void*)setGrid},
+        {"nativeCreateSession", "(III)J", (void*)createSessionNative},
+
+        {"nativeCreateSession", "(IIIJ)J", (void*)createSeededSession},
+
+        {"nativeDestroySession", "(J)Z", (void*)destroySessionNative},
+
+        {"nativeSetGrid", "([III)V", (void*)setGridDefault},
+
+        {"nativeSetGrid", "(J[III)V", (void*)setGridSession},
+
+        {"nativeFindAllMatches", "()[I", (void*)findAllMatchesDefault},
+
+        {"nativeFindAllMatches", "(J)[I", (void*)findAllMatchesSession},
+
+        {"nativeAttachBoard", "(Ljava/nio/ByteBuffer;II)Z", (void*)attachBoardDefault},
+
+        {"nativeAttachBoard", "(JLjava/nio/ByteBuffer;II)Z", (void*)attachBoardSession},
+
+        {"nativeDetachBoard", "()V", (void*)detachBoardDefault},
+
+        {"nativeDetachBoard", "(J)V", (void*)detachBoardSession},
+
+        {"nativeIsBoardAttached", "()Z", (void*)isBoardAttachedDefault},
+
+        {"nativeIsBoardAttached", "(J)Z", (void*)isBoardAttachedSession},
+
+        {"nativeBoardChanged", "()V", (void*)boardChangedDefault},
 
-        {"nativeFindAllMatches", "()[I", (jintArray*)findAllMatches}
+        {"nativeBoardChanged", "(J)V", (void*)boardChangedSession},
+
+        {"nativeSetOutputBuffers", "(Ljava/nio/ByteBuffer;Ljava/nio/ByteBuffer;)V", (void*)setOutputBuffersDefault},
+
+        {"nativeSetOutputBuffers", "(JLjava/nio/ByteBuffer;Ljava/nio/ByteBuffer;)V", (void*)setOutputBuffersSession},
+
+        {"nativeWriteMatches", "()I", (void*)writeMatchesDefault},
+
+        {"nativeWriteMatches", "(J)I", (void*)writeMatchesSession},
+
+        {"nativeWriteChangedCells", "()I", (void*)writeChangedCellsDefault},
+
+        {"nativeWriteChangedCells", "(J)I", (void*)writeChangedCellsSession},
+
+        {"nativeSetEventBuffer", "(Ljava/nio/ByteBuffer;)V", (void*)setEventBufferDefault},
+
+        {"nativeSetEventBuffer", "(JLjava/nio/ByteBuffer;)V", (void*)setEventBufferSession},
+
+        {"nativeSwapAndResolve", "(IIII)I", (void*)swapAndResolveDefault},
+
+        {"nativeSwapAndResolve", "(JIIII)I", (void*)swapAndResolveSession},
+
+        {"nativeGetStats", "()[J", (void*)getStatsDefault},
+
+        {"nativeGetStats", "(J)[J", (void*)getStatsSession},
+
+        {"nativeResetStats", "()V", (void*)resetStatsDefault},
+
+        {"nativeResetStats", "(J)V", (void*)resetStatsSession},
+
+        {"nativeFlushLog", "()I", (void*)flushLog}
 };
 
 JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void* reserved) {
@@ -75,10 +445,25 @@ JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void* reserved) {
             env->ExceptionClear();
             continue;
         }
-        if (clazz) {
-            env->RegisterNatives(clazz, method_table, sizeof(method_table) / sizeof(method_table[0]));
+        if (!clazz) {
+            continue;
+        }
+        // One at a time, so a class that does not declare the newer natives
+        // still gets the ones it does.
+        for (const JNINativeMethod& method: method_table) {
+            if (env->RegisterNatives(clazz, &method, 1) != JNI_OK) {
+                env->ExceptionClear();
+            }
         }
     }
 
+#if MATCH3_LOG_LEVEL >= MATCH3_LOG_LEVEL_INFO
+    // Nothing else drains the ring in the app (see match3_log.h).
+    startLogFlusher();
+#endif
     return JNI_VERSION_1_6;
+}
+
+JNIEXPORT void JNICALL JNI_OnUnload(JavaVM* vm, void* reserved) {
+    stopLogFlusher();
 }
\ No newline at end of file